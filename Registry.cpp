@@ -4,7 +4,10 @@
 #include <map>
 
 namespace ecss {
-	Registry::~Registry() {
+	template<typename ThreadingPolicy>
+	BasicRegistry<ThreadingPolicy>::~BasicRegistry() {
+		waitSnapshot();
+		unfreeze();
 		clear();
 
 		std::map<void*, bool> deleted;
@@ -20,7 +23,8 @@ namespace ecss {
 		}
 	}
 
-	void Registry::clear() {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::clear() {
 		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
 			const auto compContainer = mComponentsArraysMap[i];
 			if (!compContainer) {
@@ -33,9 +37,41 @@ namespace ecss {
 
 		std::unique_lock lock(mEntitiesMutex);
 		mEntities.clear();
+		mLastTakenEntity = 0;
 	}
 
-	void Registry::destroyComponents(EntityId entity) const {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::reset(bool keepCapacity) {
+		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+			const auto compContainer = mComponentsArraysMap[i];
+			if (!compContainer || std::find(mComponentsArraysMap.begin(), mComponentsArraysMap.begin() + i, compContainer) != mComponentsArraysMap.begin() + i) {
+				continue;
+			}
+
+			auto lock = containerWriteLock(static_cast<ECSType>(i));
+			compContainer->reset(keepCapacity);
+		}
+
+		std::unique_lock lock(mEntitiesMutex);
+		mEntities.clear();
+		mLastTakenEntity = 0;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::flushPendingComponents() {
+		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+			const auto compContainer = mComponentsArraysMap[i];
+			if (!compContainer) {
+				continue;
+			}
+
+			auto lock = containerWriteLock(static_cast<ECSType>(i));
+			compContainer->flushPending();
+		}
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::destroyComponents(EntityId entity) const {
 		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
 			const auto compContainer = mComponentsArraysMap[i];
 			if (!compContainer) {
@@ -47,26 +83,100 @@ namespace ecss {
 		}
 	}
 
-	EntityId Registry::takeEntity() {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::freeze() {
+		waitSnapshot();
+
+		std::unique_lock lock(mutex);
+		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+			if (const auto compContainer = mComponentsArraysMap[i]) {
+				auto containerLock = containerWriteLock(static_cast<ECSType>(i));
+				compContainer->setFrozen(true);
+			}
+		}
+
+		mFrozen = true;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::unfreeze() {
+		mFrozen = false;
+
+		std::unique_lock lock(mutex);
+		for (const auto compContainer : mComponentsArraysMap) {
+			if (compContainer) {
+				compContainer->setFrozen(false);
+			}
+		}
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::sealTypes() {
+		std::unique_lock lock(mutex);
+		mTypesSealed = true;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::unsealTypes() {
+		std::unique_lock lock(mutex);
+		mTypesSealed = false;
+	}
+
+	template<typename ThreadingPolicy>
+	EntityId BasicRegistry<ThreadingPolicy>::takeEntity() {
+		assert(!isFrozen() && "frozen registry can't be modified");
+		std::unique_lock lock(mEntitiesMutex);
+
+		EntityId id = 0;
+		switch (mEntitiesAllocation) {
+		case LOWEST_FREE_ID:
+			id = mEntities.firstFree();
+			break;
+		case RECYCLE_IN_BLOCK: {
+			const auto blockBegin = mLastTakenEntity / mAllocationBlockSize * mAllocationBlockSize;
+			id = mEntities.firstFree(blockBegin);
+			if (id - blockBegin >= mAllocationBlockSize) {
+				id = mEntities.firstFree();
+			}
+			break;
+		}
+		default:
+			mLastTakenEntity = mEntities.take();//keeps RECYCLE_IN_BLOCK block right if policy is switched later
+			return mLastTakenEntity;
+		}
+
+		mEntities.insert({ id, id + 1 });
+		mLastTakenEntity = id;
+		return id;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::setEntitiesAllocation(EntitiesAllocation allocation, EntityId blockSize) {
+		assert(blockSize && "allocation block can't be empty");
 		std::unique_lock lock(mEntitiesMutex);
-		return { mEntities.take() };
+		mEntitiesAllocation = allocation;
+		mAllocationBlockSize = std::max(blockSize, EntityId(1));
 	}
 
-	bool Registry::contains(EntityId entityId) const {
+	template<typename ThreadingPolicy>
+	bool BasicRegistry<ThreadingPolicy>::contains(EntityId entityId) const {
 		return mEntities.contains(entityId);
 	}
 
-	void Registry::destroyEntity(EntityId entity) {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::destroyEntity(EntityId entity) {
 		if (!entity) {
 			return;
 		}
 
+		assert(!isFrozen() && "frozen registry can't be modified");
 		std::unique_lock lock(mEntitiesMutex);
 		mEntities.erase(entity);
 		destroyComponents(entity);
 	}
 
-	void Registry::destroyEntities(std::vector<EntityId>& entities) {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::destroyEntities(std::vector<EntityId>& entities) {
 		if (entities.empty()) {
 			return;
 		}
@@ -89,7 +199,45 @@ namespace ecss {
 		}
 	}
 
-	void Registry::removeEmptySectors() {
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::destroyRange(EntityId first, EntityId last) {
+		if (first >= last) {
+			return;
+		}
+
+		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+			const auto compContainer = mComponentsArraysMap[i];
+			if (!compContainer) {
+				continue;
+			}
+
+			auto lock = containerWriteLock(static_cast<ECSType>(i));
+			compContainer->destroySectorsRange(first, last);
+		}
+
+		std::unique_lock lock(mEntitiesMutex);
+		mEntities.erase({ first, last });
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::shrinkToFit() {
+		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+			const auto compContainer = mComponentsArraysMap[i];
+			if (!compContainer || std::find(mComponentsArraysMap.begin(), mComponentsArraysMap.begin() + i, compContainer) != mComponentsArraysMap.begin() + i) {
+				continue;
+			}
+
+			auto lock = containerWriteLock(static_cast<ECSType>(i));
+			compContainer->shrinkToFit();
+			compContainer->shrinkSectorsMap();
+		}
+
+		std::unique_lock lock(mEntitiesMutex);
+		mEntities.ranges.shrink_to_fit();
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::removeEmptySectors() {
 		for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
 			const auto compContainer = mComponentsArraysMap[i];
 			if (!compContainer) {
@@ -101,11 +249,308 @@ namespace ecss {
 		}
 	}
 
-	const std::vector<EntityId> Registry::getAllEntities() {
-		std::shared_lock lock(mEntitiesMutex);
+	template<typename ThreadingPolicy>
+	const std::vector<EntityId> BasicRegistry<ThreadingPolicy>::getAllEntities() {
+		auto lock = isFrozen() ? std::shared_lock<Mutex>() : std::shared_lock(mEntitiesMutex);
 		return mEntities.getAll();
 	}
 
+	template<typename ThreadingPolicy>
+	bool BasicRegistry<ThreadingPolicy>::beginAsyncSnapshot(const std::string& path, std::vector<ECSType>* skippedTypes) {
+		if (isSnapshotInProgress()) {
+			return false;
+		}
+		waitSnapshot();
+
+		std::vector<Snapshot::ContainerSource> containers;
+		{
+			auto lock = std::shared_lock(mutex);
+			for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+				const auto container = mComponentsArraysMap[i];
+				if (!container) {
+					continue;
+				}
+
+				if (!container->isTriviallyCopyable()) {
+					if (skippedTypes) {
+						skippedTypes->push_back(static_cast<ECSType>(i));
+					}
+					continue;
+				}
+
+				if (std::find_if(containers.begin(), containers.end(), [container](const Snapshot::ContainerSource& source) { return source.array == container; }) == containers.end()) {
+					containers.push_back({ container, mComponentsArraysMutexes[i] });
+				}
+			}
+		}
+
+		std::vector<std::pair<EntityId, EntityId>> entities;
+		{
+			std::shared_lock lock(mEntitiesMutex);
+			entities.assign(mEntities.ranges.begin(), mEntities.ranges.end());
+		}
+
+		mSnapshotWriter = std::make_unique<AsyncSnapshotWriter>(path, getTypesDictionary(), std::move(entities), std::move(containers));
+		if constexpr (!THREAD_SAFE) {
+			mSnapshotWriter->wait();//containers aren't guarded, so single threaded registry can't be modified while snapshot is written
+		}
+		return true;
+	}
+
+	template<typename ThreadingPolicy>
+	uint32_t BasicRegistry<ThreadingPolicy>::applyStreamedData(StreamingSnapshotLoader& loader, uint32_t maxPieces) {
+		std::vector<std::pair<EntityId, EntityId>> entities;
+		if (loader.tryPopEntities(entities)) {
+			loader.setTypesRemap(makeTypesRemap(loader.getTypes()));
+
+			std::unique_lock lock(mEntitiesMutex);
+			for (auto& idsRange : entities) {
+				mEntities.insert(idsRange);
+			}
+		}
+
+		uint32_t applied = 0;
+		StreamingSnapshotLoader::Piece piece;
+		while (applied < maxPieces && loader.tryPopPiece(piece)) {
+			if (piece.membersLayout.empty()) {
+				continue;
+			}
+
+			if (const auto& remap = loader.getTypesRemap(); !remap.empty()) {
+				for (auto& [typeId, offset] : piece.membersLayout) {
+					typeId = typeId < remap.size() ? remap[typeId] : Memory::ReflectionHelper::INVALID_TYPE;
+				}
+				std::sort(piece.membersLayout.begin(), piece.membersLayout.end());
+			}
+
+			const auto typeId = piece.membersLayout.front().first;
+			const auto container = getComponentContainer(typeId);
+			if (!container || !container->hasLayout(piece.membersLayout, piece.sectorSize)) {
+				continue;
+			}
+
+			auto lock = containerWriteLock(typeId);
+			container->mergeSectors(piece.data.data(), piece.count);
+			applied++;
+		}
+
+		return applied;
+	}
+
+	template<typename ThreadingPolicy>
+	std::vector<std::pair<ECSType, uint64_t>> BasicRegistry<ThreadingPolicy>::getTypesDictionary() {
+		std::vector<std::pair<ECSType, uint64_t>> types(mReflectionHelper.getTypesCount());
+		for (ECSType type = 0; type < types.size(); type++) {
+			types[type] = { type, mReflectionHelper.getStableId(type) };
+		}
+
+		return types;
+	}
+
+	template<typename ThreadingPolicy>
+	std::vector<ECSType> BasicRegistry<ThreadingPolicy>::makeTypesRemap(const std::vector<std::pair<ECSType, uint64_t>>& types) {
+		bool identity = true;
+		ECSType maxType = 0;
+		for (auto& [type, stableId] : types) {
+			identity = identity && mReflectionHelper.getStableId(type) == stableId;
+			maxType = std::max(maxType, type);
+		}
+
+		if (identity) {
+			return {};
+		}
+
+		std::vector<ECSType> remap(static_cast<size_t>(maxType) + 1, Memory::ReflectionHelper::INVALID_TYPE);
+		for (auto& [type, stableId] : types) {
+			remap[type] = mReflectionHelper.findType(stableId);
+		}
+
+		return remap;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::recordAccess(std::vector<ECSType>&& typeIds) {
+		std::sort(typeIds.begin(), typeIds.end());
+		typeIds.erase(std::unique(typeIds.begin(), typeIds.end()), typeIds.end());
+
+		std::unique_lock lock(mAccessProfileMutex);
+		mAccessProfile[std::move(typeIds)]++;
+	}
+
+	template<typename ThreadingPolicy>
+	void BasicRegistry<ThreadingPolicy>::resetAccessProfile() {
+		std::unique_lock lock(mAccessProfileMutex);
+		mAccessProfile.clear();
+	}
+
+	template<typename ThreadingPolicy>
+	std::vector<std::pair<std::vector<ECSType>, uint64_t>> BasicRegistry<ThreadingPolicy>::getAccessProfile() {
+		std::unique_lock lock(mAccessProfileMutex);
+		return { mAccessProfile.begin(), mAccessProfile.end() };
+	}
+
+	template<typename ThreadingPolicy>
+	std::vector<std::vector<ECSType>> BasicRegistry<ThreadingPolicy>::getRecommendedGroupings(uint64_t minCount) {
+		auto profile = getAccessProfile();
+		std::stable_sort(profile.begin(), profile.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		std::vector<std::vector<ECSType>> groupings;
+		std::vector<bool> grouped;
+		for (auto& [typeIds, count] : profile) {
+			if (count < minCount || typeIds.size() < 2 || typeIds.size() > Memory::MAX_SECTOR_MEMBERS) {
+				continue;
+			}
+
+			if (grouped.size() <= typeIds.back()) {
+				grouped.resize(typeIds.back() + 1, false);
+			}
+
+			if (std::any_of(typeIds.begin(), typeIds.end(), [&grouped](ECSType type) { return grouped[type]; })) {
+				continue;
+			}
+
+			for (const auto type : typeIds) {
+				grouped[type] = true;
+			}
+			groupings.push_back(typeIds);
+		}
+
+		return groupings;
+	}
+
+	template<typename ThreadingPolicy>
+	bool BasicRegistry<ThreadingPolicy>::regroupComponents(const std::vector<ECSType>& typeIds, uint8_t flags) {
+		assert(!isFrozen() && "frozen registry can't be modified");
+		assert(!isTypesSealed() && "sealed registry can't regroup containers");
+
+		auto sortedIds = typeIds;
+		std::sort(sortedIds.begin(), sortedIds.end());
+		if (sortedIds.empty() || sortedIds.size() > Memory::MAX_SECTOR_MEMBERS || sortedIds.back() >= mReflectionHelper.getTypesCount() || std::adjacent_find(sortedIds.begin(), sortedIds.end()) != sortedIds.end()) {
+			return false;
+		}
+
+		waitSnapshot();//writer keeps pointers to containers
+
+		std::unique_lock lock(mutex);
+
+		std::vector<std::pair<Memory::SectorsArray*, std::shared_mutex*>> sources;
+		std::vector<std::unique_lock<std::shared_mutex>> locks;
+		for (const auto type : typeIds) {
+			prepareForContainer(type);
+
+			const auto source = mComponentsArraysMap[type];
+			if (source && std::find_if(sources.begin(), sources.end(), [source](const auto& pair) { return pair.first == source; }) == sources.end()) {
+				sources.emplace_back(source, mComponentsArraysMutexes[type]);
+				if (mComponentsArraysMutexes[type]) {
+					locks.emplace_back(*mComponentsArraysMutexes[type]);
+				}
+			}
+		}
+
+		const auto container = Memory::SectorsArray::createSectorsArray(mReflectionHelper, typeIds, 0, 10240, flags);
+		for (const auto& [source, sourceMutex] : sources) {
+			source->flushPending();
+		}
+
+		for (const auto type : typeIds) {
+			const auto source = mComponentsArraysMap[type];
+			if (!source) {
+				continue;
+			}
+
+			const auto functions = mReflectionHelper.getFunctionTable(type);
+			const auto offset = source->getTypeOffset(type);
+			const auto bit = source->getTypeBit(type);
+			for (auto i = source->beginIdx(); i < source->endIdx(); i = source->nextIdx(i)) {
+				const auto sector = source->getSectorByIdx(i);
+				if (!sector->isAlive(offset)) {
+					continue;
+				}
+
+				functions.move(container->acquireSector(type, sector->id), sector->getMemberPtr(offset));
+				sector->setAlive(offset, bit, false);
+				functions.destructor(sector->getMemberPtr(offset));
+			}
+		}
+
+		const auto containerMutex = createContainerMutex();
+		for (const auto type : typeIds) {
+			mComponentsArraysMap[type] = container;
+			mComponentsArraysMutexes[type] = containerMutex;
+		}
+
+		for (const auto& [source, sourceMutex] : sources) {//surviving sources are compacted while their locks are still held
+			if (std::find(mComponentsArraysMap.begin(), mComponentsArraysMap.end(), source) != mComponentsArraysMap.end()) {
+				source->removeEmptySectors();
+			}
+		}
+
+		locks.clear();
+		for (const auto& [source, sourceMutex] : sources) {
+			if (std::find(mComponentsArraysMap.begin(), mComponentsArraysMap.end(), source) == mComponentsArraysMap.end()) {//all types were moved out
+				delete sourceMutex;
+				delete source;
+			}
+		}
+
+		return true;
+	}
+
+	template<typename ThreadingPolicy>
+	RegistryMemoryUsage BasicRegistry<ThreadingPolicy>::getMemoryUsage() {
+		RegistryMemoryUsage usage;
+
+		//containers are collected under registry lock and measured after it is released, so registry and container locks are never held together
+		std::vector<std::pair<ECSType, Snapshot::ContainerSource>> containers;
+		{
+			auto lock = isContainersTableImmutable() ? std::shared_lock<Mutex>() : std::shared_lock(mutex);
+			usage.containersTable = mComponentsArraysMap.capacity() * sizeof(Memory::SectorsArray*) + mComponentsArraysMutexes.capacity() * sizeof(std::shared_mutex*);
+
+			for (size_t i = 0; i < mComponentsArraysMap.size(); i++) {
+				const auto container = mComponentsArraysMap[i];
+				if (!container || std::find(mComponentsArraysMap.begin(), mComponentsArraysMap.begin() + i, container) != mComponentsArraysMap.begin() + i) {
+					continue;
+				}
+
+				if (mComponentsArraysMutexes[i]) {
+					usage.containersTable += sizeof(std::shared_mutex);
+				}
+
+				containers.push_back({ static_cast<ECSType>(i), { container, mComponentsArraysMutexes[i] } });
+			}
+		}
+
+		for (const auto& [typeId, source] : containers) {
+			auto containerLock = source.mutex && !source.array->isFrozen() ? std::shared_lock(*source.mutex) : std::shared_lock<std::shared_mutex>();
+			usage.containers.emplace_back(typeId, source.array->getMemoryUsage());
+		}
+
+		auto lock = isFrozen() ? std::shared_lock<Mutex>() : std::shared_lock(mEntitiesMutex);
+		usage.entitiesRanges = mEntities.ranges.size() * sizeof(EntitiesRanges::range);
+		for (auto& [first, second] : mEntities.ranges) {
+			usage.entitiesCount += second - first;
+		}
+
+		return usage;
+	}
+
+	template<typename ThreadingPolicy>
+	bool BasicRegistry<ThreadingPolicy>::isSnapshotInProgress() const {
+		return mSnapshotWriter && !mSnapshotWriter->isFinished();
+	}
+
+	template<typename ThreadingPolicy>
+	bool BasicRegistry<ThreadingPolicy>::waitSnapshot() {
+		if (!mSnapshotWriter) {
+			return false;
+		}
+
+		const bool succeeded = mSnapshotWriter->wait();
+		mSnapshotWriter.reset();
+
+		return succeeded;
+	}
+
 	EntityId EntitiesRanges::take() {
 		if (ranges.empty()) {
 			ranges.push_back({ 0,0 });
@@ -122,6 +567,15 @@ namespace ecss {
 		return id;
 	}
 
+	EntityId EntitiesRanges::firstFree(EntityId from) const {
+		auto it = std::upper_bound(ranges.begin(), ranges.end(), from, [](EntityId id, const range& entRange) { return id < entRange.second; });//first range which ends after from
+		for (; it != ranges.end() && it->first <= from; ++it) {
+			from = it->second;
+		}
+
+		return from;
+	}
+
 	void EntitiesRanges::insert(EntityId id) {
 		for (auto i = 0u; i < ranges.size(); i++) {
 			auto& range = ranges[i];
@@ -161,22 +615,83 @@ namespace ecss {
 		ranges.push_back({ id, id + 1});
 	}
 
+	void EntitiesRanges::insert(range idsRange) {
+		if (idsRange.first >= idsRange.second) {
+			return;
+		}
+
+		auto it = std::lower_bound(ranges.begin(), ranges.end(), idsRange, [](const range& a, const range& b) { return a.second < b.first; });//first range which touches or follows inserted one
+		if (it == ranges.end() || it->first > idsRange.second) {
+			ranges.insert(it, idsRange);
+			return;
+		}
+
+		it->first = std::min(it->first, idsRange.first);
+		it->second = std::max(it->second, idsRange.second);
+
+		auto next = it + 1;
+		while (next != ranges.end() && next->first <= it->second) {
+			it->second = std::max(it->second, next->second);
+			++next;
+		}
+		ranges.erase(it + 1, next);
+	}
+
 	void EntitiesRanges::erase(EntityId id) {
 		for (auto entRangeIt = ranges.begin(); entRangeIt != ranges.end(); ++entRangeIt) {
 			if (id >= entRangeIt->first && id < entRangeIt->second) {
-				if (id == entRangeIt->second - 1) {
+				if (id == entRangeIt->first) {
+					entRangeIt->first++;
+					if (entRangeIt->first == entRangeIt->second) {
+						ranges.erase(entRangeIt);
+					}
+				}
+				else if (id == entRangeIt->second - 1) {
 					entRangeIt->second--;
 				}
 				else {
-					auto it = ranges.insert(entRangeIt, range{});
+					auto it = ranges.insert(entRangeIt, range{ entRangeIt->first, id });
 					(it + 1)->first = id + 1;
-					it->second = id;
 				}
 				break;
 			}
 		}
 	}
 
+	void EntitiesRanges::erase(range idsRange) {
+		if (idsRange.first >= idsRange.second) {
+			return;
+		}
+
+		auto it = std::lower_bound(ranges.begin(), ranges.end(), idsRange, [](const range& a, const range& b) { return a.second <= b.first; });//first range which ends after erased begin
+		if (it == ranges.end() || it->first >= idsRange.second) {
+			return;
+		}
+
+		if (it->first < idsRange.first) {
+			if (it->second > idsRange.second) {
+				const auto tail = range{ idsRange.second, it->second };
+				it->second = idsRange.first;
+				ranges.insert(it + 1, tail);
+				return;
+			}
+
+			it->second = idsRange.first;
+			++it;
+		}
+
+		auto eraseEnd = it;
+		while (eraseEnd != ranges.end() && eraseEnd->second <= idsRange.second) {
+			++eraseEnd;
+		}
+
+		if (eraseEnd != ranges.end() && eraseEnd->first < idsRange.second) {
+			eraseEnd->first = idsRange.second;
+		}
+
+		ranges.erase(it, eraseEnd);
+	}
+
 	bool EntitiesRanges::contains(EntityId id) const {
 		if (id >= ranges.back().second) {
 			return false;
@@ -200,4 +715,7 @@ namespace ecss {
 
 		return res;
 	}
+
+	template class BasicRegistry<MultiThreaded>;
+	template class BasicRegistry<SingleThreaded>;
 }
@@ -8,8 +8,14 @@
 #include <deque>
 #include <set>
 #include <array>
+#include <map>
+#include <memory>
 #include <shared_mutex>
+#include <span>
 
+#include "Snapshot.h"
+#include "SortedView.h"
+#include "memory/MappedFile.h"
 #include "memory/SectorsArray.h"
 
 namespace ecss {
@@ -46,8 +52,12 @@ namespace ecss {
 		}
 
 		EntityId take();
+		//the lowest id not less than from which isn't in ranges
+		EntityId firstFree(EntityId from = 0) const;
 		void insert(EntityId id);
+		void insert(range idsRange);
 		void erase(EntityId id);
+		void erase(range idsRange);
 		void clear() { ranges.clear(); }
 		size_t size() { return ranges.size(); }
 		range& front() { return ranges.front(); }
@@ -57,21 +67,98 @@ namespace ecss {
 		std::vector<EntityId> getAll() const;
 	};
 
-	class Registry final {
+	/*
+		columns file written by Registry::exportColumns
+
+		uint32 magic, uint32 columnsCount, columnsCount * ColumnHeader
+		column data blocks (ids, validity bitmap, values), every block is aligned to cache line, offsets in headers are from the file begin
+	*/
+	struct ColumnHeader {
+		static constexpr uint32_t MAGIC = 0x4C4F4345;//ECOL
+
+		ECSType typeId = 0;
+		uint16_t valueSize = 0;
+		uint32_t rowsCount = 0;
+		uint64_t idsOffset = 0;
+		uint64_t validityOffset = 0;
+		uint64_t valuesOffset = 0;
+	};
+
+	//memory taken by registry, in bytes, see Registry::getMemoryUsage
+	struct RegistryMemoryUsage {
+		std::vector<std::pair<ECSType, Memory::SectorsArray::MemoryUsage>> containers;//container is listed once, by its first type
+		size_t entitiesRanges = 0;
+		size_t containersTable = 0;
+		size_t entitiesCount = 0;
+
+		size_t total() const {
+			size_t result = entitiesRanges + containersTable;
+			for (auto& [type, usage] : containers) {
+				result += usage.total();
+			}
+
+			return result;
+		}
+	};
+
+	/*
+		how Registry::takeEntity chooses new entity id
+
+		APPEND_TO_FIRST_RANGE - id after the first range of taken ids, ids freed in later ranges aren't reused till the first range reaches them
+		LOWEST_FREE_ID - the lowest free id, ids space and sectors maps stay as dense as live entities after churn
+		RECYCLE_IN_BLOCK - the lowest free id in the block of the last taken id, when the block is full the lowest free id at all,
+						   entities created together stay in the same ids block and so in the same chunks
+	*/
+	enum EntitiesAllocation : uint8_t {
+		APPEND_TO_FIRST_RANGE,
+		LOWEST_FREE_ID,
+		RECYCLE_IN_BLOCK,
+	};
+
+	/*
+		threading policies of BasicRegistry, Registry is the multithreaded one
+
+		MultiThreaded - containers table, entities and every container are guarded by shared mutexes
+		SingleThreaded - registry is used only from one thread, container mutexes aren't created, all locks are empty and lock vectors are never filled
+	*/
+	struct MultiThreaded {
+		static constexpr bool THREAD_SAFE = true;
+	};
+
+	struct SingleThreaded {
+		static constexpr bool THREAD_SAFE = false;
+	};
+
+	//mutex of single threaded registry, does nothing
+	struct NullMutex {
+		void lock() {}
+		void unlock() {}
+		bool try_lock() { return true; }
+		void lock_shared() {}
+		void unlock_shared() {}
+		bool try_lock_shared() { return true; }
+	};
+
+	template<typename ThreadingPolicy = MultiThreaded>
+	class BasicRegistry final {
 		template <typename T, typename ...ComponentTypes>
 		friend class ComponentArraysIterator;
 
-		Registry(const Registry& other) = delete;
-		Registry& operator=(const Registry& other) = delete;
-		Registry(Registry&& other) noexcept = delete;
-		Registry& operator=(Registry&& other) noexcept = delete;
+		static constexpr bool THREAD_SAFE = ThreadingPolicy::THREAD_SAFE;
+		using Mutex = std::conditional_t<THREAD_SAFE, std::shared_mutex, NullMutex>;
+
+		BasicRegistry(const BasicRegistry& other) = delete;
+		BasicRegistry& operator=(const BasicRegistry& other) = delete;
+		BasicRegistry(BasicRegistry&& other) noexcept = delete;
+		BasicRegistry& operator=(BasicRegistry&& other) noexcept = delete;
 
 	public:
-		Registry() = default;
-		~Registry();
+		BasicRegistry() = default;
+		~BasicRegistry();
 
 		template<typename... ComponentTypes>
 		std::tuple<ComponentTypes*...> getComponents(EntityId entity) {
+			profileAccess<ComponentTypes...>();
 			auto lock = containersReadLock<ComponentTypes...>();
 			return std::forward_as_tuple(getComponentNotSafe<ComponentTypes>(entity)...);
 		}
@@ -84,7 +171,45 @@ namespace ecss {
 
 		template <class T>
 		T* getComponentNotSafe(EntityId entity) {
-			return getComponentContainer<T>()->getComponent<T>(entity, mReflectionHelper.getTypeId<T>());
+			const auto container = getComponentContainer<T>();
+			return container ? container->template getComponent<T>(entity, mReflectionHelper.getTypeId<T>()) : nullptr;
+		}
+
+		//writer side of Memory::DoubleBuffered<T> component - value which will be published with next swapComponentBuffers
+		template <class T>
+		T* getComponentNext(EntityId entity) {
+			auto lock = containersReadLock<Memory::DoubleBuffered<T>>();
+			const auto container = getComponentContainer<Memory::DoubleBuffered<T>>();
+			const auto component = container ? container->template getComponent<Memory::DoubleBuffered<T>>(entity, mReflectionHelper.getTypeId<Memory::DoubleBuffered<T>>()) : nullptr;
+			return component ? &component->next(container->getFrontBuffer()) : nullptr;
+		}
+
+		/*
+		  reader side of Memory::DoubleBuffered<T> component - last published value, writes through getComponentNext aren't visible till swapComponentBuffers
+		  container lock isn't taken, buffer is chosen by atomic front index, so readers never block writers filling next values,
+		  sectors of the container must not be added or removed meanwhile (structural changes at sync point, see Memory::DoubleBuffered)
+		  container lookup is lock free when types are sealed or registry is frozen, otherwise it takes registry read lock
+		*/
+		template <class T>
+		const T* getComponentPrev(EntityId entity) {
+			const auto container = getComponentContainer<Memory::DoubleBuffered<T>>();
+			const auto component = container ? container->template getComponent<Memory::DoubleBuffered<T>>(entity, mReflectionHelper.getTypeId<Memory::DoubleBuffered<T>>()) : nullptr;
+			return component ? &component->prev(container->getFrontBuffer()) : nullptr;
+		}
+
+		//index of published buffer, for iterating through DoubleBuffered<T> components with forEach
+		template <class T>
+		uint8_t getFrontBuffer() {
+			const auto container = getComponentContainer<Memory::DoubleBuffered<T>>();
+			return container ? container->getFrontBuffer() : 0;
+		}
+
+		//publishes all next values of Memory::DoubleBuffered<T> (and other double buffered components stored in the same container)
+		template <class T>
+		void swapComponentBuffers() {
+			if (const auto container = getComponentContainer<Memory::DoubleBuffered<T>>()) {
+				container->swapBuffers();
+			}
 		}
 
 		template <class T, class ...Args>
@@ -94,6 +219,11 @@ namespace ecss {
 			}
 
 			auto container = getComponentContainer<T>();
+			if (!container) {
+				assert(false && "types sealed or frozen registry can't create containers, register component before sealTypes");
+				return nullptr;
+			}
+
 			auto lock = containerWriteLock<T>();
 			return static_cast<T*>(new(container->acquireSector(mReflectionHelper.getTypeId<T>(), entity))T(std::forward<Args>(args)...));
 		}
@@ -101,6 +231,11 @@ namespace ecss {
 		template<typename T>
 		void copyComponentsArrayToRegistry(Memory::SectorsArray* array) {
 			auto cont = getComponentContainer<T>();
+			if (!cont) {
+				assert(false && "types sealed or frozen registry can't create containers, register component before sealTypes");
+				return;
+			}
+
 			//auto lock = containerWriteLock<T>();
 			*cont = *array;
 		}
@@ -108,14 +243,44 @@ namespace ecss {
 		//you can create component somewhere in another thread and move it into container here
 		template <class T>
 		void moveComponentToEntity(EntityId entity, T* component) {
-			getComponentContainer<T>()->move<T>(entity, component, mReflectionHelper.getTypeId<T>());
+			auto container = getComponentContainer<T>();
+			if (!container) {
+				assert(false && "types sealed or frozen registry can't create containers, register component before sealTypes");
+				return;
+			}
+
+			auto lock = containerWriteLock<T>();
+			container->template move<T>(entity, component, mReflectionHelper.getTypeId<T>());
 		}
 
 		template <class T>
 		void copyComponentToEntity(EntityId entity, T* component) {
-			getComponentContainer<T>()->insert<T>(entity, component, mReflectionHelper.getTypeId<T>());
+			auto container = getComponentContainer<T>();
+			if (!container) {
+				assert(false && "types sealed or frozen registry can't create containers, register component before sealTypes");
+				return;
+			}
+
+			auto lock = containerWriteLock<T>();
+			container->template insert<T>(entity, component, mReflectionHelper.getTypeId<T>());
 		}
 
+		//lock free version of moveComponentToEntity for worker threads, component waits in container queue till flushPendingComponents
+		template <class T>
+		void enqueueComponentToEntity(EntityId entity, T&& component) {
+			using Type = std::decay_t<T>;
+			auto container = getComponentContainer<Type>();
+			if (!container) {
+				assert(false && "types sealed or frozen registry can't create containers, register component before sealTypes");
+				return;
+			}
+
+			container->enqueue(entity, std::forward<T>(component), mReflectionHelper.getTypeId<Type>());
+		}
+
+		//moves all enqueued components into containers, should be called by owning thread at sync point
+		void flushPendingComponents();
+
 		template <class T>
 		void removeComponent(EntityId entity) {
 			auto componentTypeId = mReflectionHelper.getTypeId<T>();
@@ -141,19 +306,20 @@ namespace ecss {
 		 0x..[component 2]
 		 0x..[    ...    ]
 
-		  should be called before any getContainer calls
+		  should be called before any getContainer calls, grouping of live registry can be changed with regroupComponents
+		  flags - Memory::SectorsArrayFlags, CACHE_LINE_STRIDE for containers which are written from multiple threads in parallel, CHUNK_LOCAL for containers with random inserts and erases
 		*/
 		template<typename... Components>
-		void initCustomComponentsContainer() {
+		void initCustomComponentsContainer(uint8_t flags = Memory::DEFAULT) {
 			std::unique_lock lock(mutex);
 			bool added = false;
 
 			((added |= prepareForContainer<Components>()), ...);
 			assert(!added);
 
-			auto container = Memory::SectorsArray::createSectorsArray<Components...>(mReflectionHelper);
+			auto container = Memory::SectorsArray::createSectorsArray<Components...>(mReflectionHelper, 0, 10240, flags);
 
-			auto containerMutex = new std::shared_mutex();
+			auto containerMutex = createContainerMutex();
 
 			((mComponentsArraysMap[mReflectionHelper.getTypeId<Components>()] = container), ...);
 			((mComponentsArraysMutexes[mReflectionHelper.getTypeId<Components>()] = containerMutex), ...);
@@ -171,26 +337,214 @@ namespace ecss {
 			}
 		}
 
+		/*batched getComponents for list of entities - locks are taken once, entities are visited in id order (so sectors are visited chunk by chunk) with prefetch
+		  out should have place for every entity, it is filled in the original order
+		*/
+		template<typename... Components>
+		void gather(std::span<const EntityId> entities, std::type_identity_t<std::span<std::tuple<Components*...>>> out) {
+			assert(out.size() >= entities.size() && "output should have place for every entity");
+			constexpr size_t PREFETCH_DISTANCE = 8;
+
+			profileAccess<Components...>();
+			auto lock = containersReadLock<Components...>();
+			const std::array<Memory::SectorsArray*, sizeof...(Components)> arrays = { getComponentContainer<Components>()... };
+			const std::array<uint16_t, sizeof...(Components)> offsets = { (arrays[types::getIndex<Components, Components...>()] ? arrays[types::getIndex<Components, Components...>()]->getTypeOffset(mReflectionHelper.getTypeId<Components>()) : uint16_t(0))... };
+
+			std::vector<std::pair<EntityId, uint32_t>> order(entities.size());
+			for (auto i = 0u; i < entities.size(); i++) {
+				order[i] = { entities[i], i };
+			}
+			std::sort(order.begin(), order.end());
+
+			for (size_t i = 0; i < order.size(); i++) {
+				if (i + PREFETCH_DISTANCE < order.size()) {
+					for (const auto array : arrays) {
+						if (array) {
+							array->prefetchSector(order[i + PREFETCH_DISTANCE].first);
+						}
+					}
+				}
+
+				const auto entity = order[i].first;
+				out[order[i].second] = { (arrays[types::getIndex<Components, Components...>()] ? arrays[types::getIndex<Components, Components...>()]->template getComponentByOffset<Components>(entity, offsets[types::getIndex<Components, Components...>()]) : nullptr)... };
+			}
+		}
+
+		//exports components as dense columns (ids, validity bitmap, values) into memory mapped file, see ColumnHeader, every container is copied in parallel by chunks
 		template<typename... Components>
-		inline ComponentArraysIterator<Components...> forEach(EntitiesRanges ranges = {}, bool lock = true) { return ComponentArraysIterator<Components...>(this, std::move(ranges), lock); }
+		bool exportColumns(const std::string& path, uint32_t threadsCount = std::thread::hardware_concurrency()) {
+			auto lock = containersReadLock<Components...>();
+
+			std::array<ColumnHeader, sizeof...(Components)> headers;
+			size_t fileSize = sizeof(uint32_t) * 2 + sizeof(headers);
+			const auto place = [&fileSize](size_t bytes) {
+				fileSize = (fileSize + Memory::CACHE_LINE_SIZE - 1) / Memory::CACHE_LINE_SIZE * Memory::CACHE_LINE_SIZE;
+				const auto offset = fileSize;
+				fileSize += bytes;
+				return offset;
+			};
+
+			//components without container (sealed or frozen registry) are exported as empty columns
+			const std::array<uint32_t, sizeof...(Components)> rows = { (getComponentContainer<Components>() ? getComponentContainer<Components>()->size() : 0u)... };
+			((
+				headers[types::getIndex<Components, Components...>()].typeId = mReflectionHelper.getTypeId<Components>(),
+				headers[types::getIndex<Components, Components...>()].valueSize = static_cast<uint16_t>(sizeof(Components)),
+				headers[types::getIndex<Components, Components...>()].rowsCount = rows[types::getIndex<Components, Components...>()],
+				headers[types::getIndex<Components, Components...>()].idsOffset = place(sizeof(SectorId) * rows[types::getIndex<Components, Components...>()]),
+				headers[types::getIndex<Components, Components...>()].validityOffset = place((rows[types::getIndex<Components, Components...>()] + 7) / 8),
+				headers[types::getIndex<Components, Components...>()].valuesOffset = place(sizeof(Components) * rows[types::getIndex<Components, Components...>()])
+			), ...);
+
+			Memory::MappedFile file;
+			if (!file.create(path, fileSize)) {
+				return false;
+			}
+
+			const uint32_t columnsHeader[] = { ColumnHeader::MAGIC, static_cast<uint32_t>(sizeof...(Components)) };
+			std::memcpy(file.data(), columnsHeader, sizeof(columnsHeader));
+			std::memcpy(file.data() + sizeof(columnsHeader), headers.data(), sizeof(headers));
+
+			(exportColumnParallel<Components>(file.data(), headers[types::getIndex<Components, Components...>()], threadsCount), ...);
+
+			file.close();
+			return true;
+		}
+
+		template<typename... Components>
+		inline ComponentArraysIterator<Components...> forEach(EntitiesRanges ranges = {}, bool lock = true) { profileAccess<Components...>(); return ComponentArraysIterator<Components...>(this, std::move(ranges), lock); }
+
+		//iterates through T components in order of the view key, view is updated before iteration
+		template<typename T, typename Key>
+		inline SortedViewIterator<T, Key> forEachSorted(SortedView<T, Key>& view, bool lock = true) {
+			auto container = getComponentContainer<T>();
+			if (!container) {//unregistered component of sealed or frozen registry, nothing to iterate
+				view.invalidate();
+				return { view, nullptr, 0, {} };
+			}
+
+			const auto offset = container->getTypeOffset(mReflectionHelper.getTypeId<T>());
+
+			auto locks = lock ? containersReadLock<T>() : std::vector<std::shared_lock<std::shared_mutex>>{};
+			view.update(container, offset);
+
+			return { view, container, offset, std::move(locks) };
+		}
 
 		template <class... Components>
-		void reserve(uint32_t newCapacity) { /*auto lock = containersWriteLock<Components...>(); */(getComponentContainer<Components>()->reserve(newCapacity), ...); }
+		void reserve(uint32_t newCapacity) { /*auto lock = containersWriteLock<Components...>(); */((getComponentContainer<Components>() ? getComponentContainer<Components>()->reserve(newCapacity) : void()), ...); }
 		void clear();
+		//fast clear for registries which are filled again with the same shape - containers keep chunks and sectors maps, see SectorsArray::reset
+		void reset(bool keepCapacity = true);
 		bool contains(EntityId entityId) const;
 
 		EntityId takeEntity();
+		//blockSize is used by RECYCLE_IN_BLOCK, chunk size of containers is a good choice
+		void setEntitiesAllocation(EntitiesAllocation allocation, EntityId blockSize = 10240);
 
 		void destroyEntity(EntityId entityId);
 		void destroyEntities(std::vector<EntityId>& entities);
+		//destroys all entities in [first, last), cost depends on count of containers and chunks, not on count of entities
+		void destroyRange(EntityId first, EntityId last);
 		void removeEmptySectors();
+		//releases free chunks and cuts sectors maps of containers to the biggest live id, so memory follows live entities after churn, call after removeEmptySectors
+		void shrinkToFit();
 
 		const std::vector<EntityId> getAllEntities();
 
+		/*
+		  starts writing all containers with trivially copyable components to the file in background thread, returns false if previous snapshot is not finished yet
+		  containers with not trivially copyable components aren't written, their type ids are put into skippedTypes if it is set
+		*/
+		bool beginAsyncSnapshot(const std::string& path, std::vector<ECSType>* skippedTypes = nullptr);
+		bool isSnapshotInProgress() const;
+		//blocks till snapshot is written, returns false if it can't be written
+		bool waitSnapshot();
+
+		/*applies up to maxPieces pieces read by streaming loader, should be called at frame boundaries
+		  entities are reserved with the first call, components become visible piece by piece
+		  target containers should be already created with the same layout (getComponentContainer or initCustomComponentsContainer), pieces without matching container are skipped
+		  types ids of the file are remapped to registry ids by stable ids, remap is skipped if dictionaries match
+
+		  returns count of applied pieces
+		*/
+		uint32_t applyStreamedData(StreamingSnapshotLoader& loader, uint32_t maxPieces = 1);
+
+		//stable type id overrides hash of compiler type name, should be set before snapshot is written or loaded, see ReflectionHelper::setStableName
+		template<typename T>
+		void setStableTypeName(std::string_view name) {
+			mReflectionHelper.setStableName<T>(name);
+		}
+
+		//{type, stableId} of all registered types
+		std::vector<std::pair<ECSType, uint64_t>> getTypesDictionary();
+
+		/*access profiling counts which component sets are queried together (forEach, getComponents, gather), it is off by default
+		  profile is used for getRecommendedGroupings, which can be applied with regroupComponents
+		*/
+		void setAccessProfiling(bool enabled) { mAccessProfiling = enabled; }
+		void resetAccessProfile();
+		//{sorted types set, queries count}
+		std::vector<std::pair<std::vector<ECSType>, uint64_t>> getAccessProfile();
+
+		//greedy grouping - most frequent sets first, every type is placed in one group at most, only sets queried at least minCount times are taken
+		std::vector<std::vector<ECSType>> getRecommendedGroupings(uint64_t minCount = 1);
+
+		/*moves components of given types from their current containers into one new container, types which were grouped with others are split from them
+		  registry stays live, but it should be called at sync point - when no other thread uses registry and there are no alive iterators
+		  returns false if some type isn't registered, types are duplicated or there are more than Memory::MAX_SECTOR_MEMBERS of them
+		*/
+		bool regroupComponents(const std::vector<ECSType>& typeIds, uint8_t flags = Memory::DEFAULT);
+
+		template<typename... Components>
+		bool regroupComponents(uint8_t flags = Memory::DEFAULT) {
+			return regroupComponents({ mReflectionHelper.getTypeId<Components>()... }, flags);
+		}
+
+		//memory usage breakdown per container, bytes per entity is usage / entitiesCount
+		RegistryMemoryUsage getMemoryUsage();
+
+		/*makes registry immutable - containers table, entities and all containers, for worlds which are never modified after load
+		  reads of frozen registry don't take any locks and it can be shared between threads without synchronization, any modification is asserted in debug
+		  freeze and unfreeze should be called when no other thread uses registry
+		*/
+		void freeze();
+		void unfreeze();
+		bool isFrozen() const { return mFrozen.load(std::memory_order_relaxed); }
+
+		//freezes only selected containers, registry itself stays mutable, components of frozen containers are read without container locks
+		template<typename... Components>
+		void freezeComponents() {
+			auto lock = containersWriteLock<Components...>();
+			((getComponentContainer<Components>() ? getComponentContainer<Components>()->setFrozen(true) : void()), ...);
+		}
+
+		/*
+		  creates containers for all listed components at once, so first use of rare component in the middle of frame doesn't take registry write lock
+		  components which should share container should be grouped with initCustomComponentsContainer before
+		*/
+		template<typename... Components>
+		void registerComponents() {
+			(getComponentContainer<Components>(), ...);
+		}
+
+		/*
+		  makes containers table immutable - containers lookups don't take registry lock anymore, components are added and removed as usual
+		  all used components should be registered before, creation of new containers and regroupComponents are asserted in debug,
+		  in release unregistered components are read as nullptr and writes of them are skipped
+		  seal and unseal should be called when no other thread uses registry
+		*/
+		void sealTypes();
+		void unsealTypes();
+		bool isTypesSealed() const { return mTypesSealed.load(std::memory_order_relaxed); }
+
 		template <class T>
 		Memory::SectorsArray* getComponentContainer() {
 			const ECSType compId = mReflectionHelper.getTypeId<T>();
 
+			if (isContainersTableImmutable()) {//containers can't be created, nullptr for types without container
+				return compId < mComponentsArraysMap.size() ? mComponentsArraysMap[compId] : nullptr;
+			}
+
 			{
 				auto lock = std::shared_lock(mutex);
 				if (auto sectorsArray = mComponentsArraysMap.size() > compId ? mComponentsArraysMap[compId] : nullptr) {
@@ -203,15 +557,15 @@ namespace ecss {
 			if (!prepareForContainer(compId)) {
 				auto container = Memory::SectorsArray::createSectorsArray<T>(mReflectionHelper);
 				mComponentsArraysMap[compId] = container;
-				mComponentsArraysMutexes[compId] = new std::shared_mutex();
+				mComponentsArraysMutexes[compId] = createContainerMutex();
 			}
 
 			return mComponentsArraysMap[compId];
 		}
 
 		Memory::SectorsArray* getComponentContainer(ECSType componentTypeId) {
-			auto lock = std::shared_lock(mutex);
-			if (mComponentsArraysMap.size() >= componentTypeId) {
+			auto lock = isContainersTableImmutable() ? std::shared_lock<Mutex>() : std::shared_lock(mutex);
+			if (mComponentsArraysMap.size() <= componentTypeId) {
 				return nullptr;
 			}
 
@@ -222,6 +576,10 @@ namespace ecss {
 		std::shared_mutex* getComponentMutex() {
 			const ECSType compId = mReflectionHelper.getTypeId<T>();
 
+			if (isContainersTableImmutable()) {
+				return compId < mComponentsArraysMutexes.size() ? mComponentsArraysMutexes[compId] : nullptr;
+			}
+
 			{
 				auto lock = std::shared_lock(mutex);
 				if (auto compMutex = mComponentsArraysMutexes.size() > compId ? mComponentsArraysMutexes[compId] : nullptr) {
@@ -234,7 +592,7 @@ namespace ecss {
 			if (!prepareForContainer(compId)) {
 				auto container = Memory::SectorsArray::createSectorsArray<T>(mReflectionHelper);
 				mComponentsArraysMap[compId] = container;
-				mComponentsArraysMutexes[compId] = new std::shared_mutex();
+				mComponentsArraysMutexes[compId] = createContainerMutex();
 			}
 
 			return mComponentsArraysMutexes[compId];
@@ -243,41 +601,151 @@ namespace ecss {
 		template <class... T>
 		std::vector<std::shared_lock<std::shared_mutex>> containersReadLock() {
 			std::vector<std::shared_lock<std::shared_mutex>> res;
-			(containersLockHelper<T, std::shared_lock<std::shared_mutex>>(res), ...);
+			if constexpr (THREAD_SAFE) {
+				(containersLockHelper<T, std::shared_lock<std::shared_mutex>>(res), ...);
+			}
+
 			return res;
 		}
 
 		template <class... T>
 		std::vector<std::unique_lock<std::shared_mutex>> containersWriteLock() {
 			std::vector<std::unique_lock<std::shared_mutex>> res;
-
-			(containersLockHelper<T, std::unique_lock<std::shared_mutex>>(res), ...);
+			if constexpr (THREAD_SAFE) {
+				(containersLockHelper<T, std::unique_lock<std::shared_mutex>>(res), ...);
+			}
 
 			return res;
 		}
 
 		template <class T>
 		std::unique_lock<std::shared_mutex> containerWriteLock() {
-			return std::unique_lock {*getComponentMutex<T>()};
+			if constexpr (!THREAD_SAFE) {
+				return {};
+			}
+			else {
+				const auto mutex = getComponentMutex<T>();
+				return mutex ? std::unique_lock {*mutex} : std::unique_lock<std::shared_mutex>();
+			}
 		}
 
 		template <class T>
 		std::shared_lock<std::shared_mutex> containerReadLock() {
-			return std::shared_lock {*getComponentMutex<T>()};
+			if constexpr (!THREAD_SAFE) {
+				return {};
+			}
+			else {
+				const auto container = getComponentContainer<T>();
+				if (!container || container->isFrozen()) {
+					return {};
+				}
+
+				return std::shared_lock {*getComponentMutex<T>()};
+			}
 		}
 
 		std::unique_lock<std::shared_mutex> containerWriteLock(ECSType containerType) const {
-			return std::unique_lock {*mComponentsArraysMutexes[containerType]};
+			if constexpr (!THREAD_SAFE) {
+				return {};
+			}
+			else {
+				return std::unique_lock {*mComponentsArraysMutexes[containerType]};
+			}
 		}
 
 		std::shared_lock<std::shared_mutex> containerReadLock(ECSType containerType) const {
-			return std::shared_lock {*mComponentsArraysMutexes[containerType]};
+			if constexpr (!THREAD_SAFE) {
+				return {};
+			}
+			else {
+				if (containerType >= mComponentsArraysMap.size() || !mComponentsArraysMap[containerType] || mComponentsArraysMap[containerType]->isFrozen()) {
+					return {};
+				}
+
+				return std::shared_lock {*mComponentsArraysMutexes[containerType]};
+			}
 		}
 
 	private:
+		bool isContainersTableImmutable() const {
+			return isFrozen() || isTypesSealed();
+		}
+
+		template<typename... Components>
+		void profileAccess() {
+			if constexpr (sizeof...(Components) > 1) {
+				if (mAccessProfiling.load(std::memory_order_relaxed)) {
+					recordAccess({ mReflectionHelper.getTypeId<Components>()... });
+				}
+			}
+		}
+
+		void recordAccess(std::vector<ECSType>&& typeIds);
+
+		//file type id -> registry type id, empty if ids are the same
+		std::vector<ECSType> makeTypesRemap(const std::vector<std::pair<ECSType, uint64_t>>& types);
+
+		template<typename T>
+		void exportColumnParallel(char* data, const ColumnHeader& header, uint32_t threadsCount) {
+			const auto array = getComponentContainer<T>();
+			if (!array) {
+				return;
+			}
+
+			const auto ids = static_cast<SectorId*>(static_cast<void*>(data + header.idsOffset));
+			const auto validity = static_cast<uint8_t*>(static_cast<void*>(data + header.validityOffset));
+			const auto values = static_cast<T*>(static_cast<void*>(data + header.valuesOffset));
+
+			const auto chunks = array->chunksCount();
+			threadsCount = std::clamp(threadsCount, 1u, std::max(chunks, 1u));
+
+			std::vector<std::thread> threads;
+			uint32_t firstChunk = 0;
+			size_t firstRow = 0;
+			for (auto i = 0u; i < threadsCount; i++) {
+				const auto lastChunk = static_cast<uint32_t>(static_cast<uint64_t>(chunks) * (i + 1) / threadsCount);
+				const auto job = [=] { array->template exportColumn<T>(header.typeId, ids, values, validity, firstChunk, lastChunk, firstRow); };
+				if (i + 1 == threadsCount) {
+					job();
+				}
+				else {
+					threads.emplace_back(job);
+				}
+
+				for (; firstChunk < lastChunk; firstChunk++) {
+					firstRow += array->getChunkSpan(firstChunk).second;
+				}
+			}
+
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+
+		//nullptr for single threaded registry
+		static std::shared_mutex* createContainerMutex() {
+			if constexpr (THREAD_SAFE) {
+				return new std::shared_mutex();
+			}
+			else {
+				return nullptr;
+			}
+		}
+
 		template<typename T, typename LockType>
 		void containersLockHelper(std::vector<LockType>& res) {
+			if constexpr (std::is_same_v<LockType, std::shared_lock<std::shared_mutex>>) {
+				const auto container = getComponentContainer<T>();
+				if (!container || container->isFrozen()) {//frozen containers are read without locks
+					return;
+				}
+			}
+
 			auto mutex = getComponentMutex<T>();
+			if (!mutex) {
+				return;
+			}
+
 			if (std::find_if(res.begin(), res.end(), [&mutex](const LockType& a) {
 				return a.mutex() == mutex;
 			}) == res.end()) {
@@ -291,6 +759,7 @@ namespace ecss {
 		}
 
 		bool prepareForContainer(ECSType typeId) {
+			assert(!isTypesSealed() && "sealed registry can't create containers");
 			if (mComponentsArraysMap.size() <= typeId) {
 				mComponentsArraysMap.resize(typeId + 1, nullptr);
 				mComponentsArraysMutexes.resize(typeId + 1, nullptr);
@@ -304,15 +773,32 @@ namespace ecss {
 		Memory::ReflectionHelper mReflectionHelper;
 
 		EntitiesRanges mEntities;
+		EntitiesAllocation mEntitiesAllocation = APPEND_TO_FIRST_RANGE;
+		EntityId mAllocationBlockSize = 10240;
+		EntityId mLastTakenEntity = 0;
+
+		std::unique_ptr<AsyncSnapshotWriter> mSnapshotWriter;
 
 		std::vector<Memory::SectorsArray*> mComponentsArraysMap;
 
 		//non copyable
 		std::vector<std::shared_mutex*> mComponentsArraysMutexes;
-		mutable std::shared_mutex mEntitiesMutex;
-		std::shared_mutex mutex;
+		mutable Mutex mEntitiesMutex;
+		Mutex mutex;
+
+		std::atomic<bool> mFrozen = false;
+		std::atomic<bool> mTypesSealed = false;
+
+		std::atomic<bool> mAccessProfiling = false;
+		std::map<std::vector<ECSType>, uint64_t> mAccessProfile;
+		Mutex mAccessProfileMutex;
 	};
 
+	extern template class BasicRegistry<MultiThreaded>;
+	extern template class BasicRegistry<SingleThreaded>;
+
+	using Registry = BasicRegistry<MultiThreaded>;
+
 	/*
 		an object with selected components, which provided ability to iterate through entities like it is the container of tuple<component1,component2,component3>
 		first component type in template is the "main" one, because components stores in separate containers, the first component parent container chosen for iterating
@@ -327,19 +813,18 @@ namespace ecss {
 
 		it will iterate through first 0,1,2,3... container elements
 
-		ATTENTION
-
-		if componentContainer has multiple components in it, it will iterate through sectors, and may return nullptr for "main" component type
-		so better, if you want to merge multiple types in one sector, always create all components for sector
+		if componentContainer has multiple components in it, sectors without "main" component are skipped by sector alive mask,
+		so "main" component pointer is never nullptr, other components can be nullptr
 	*/
 	template <typename T, typename ...ComponentTypes>
 	class ComponentArraysIterator final {
 	public:
-		explicit ComponentArraysIterator(Registry* manager, EntitiesRanges&& ranges = {}, bool lock = true) {
-			((mArrays[types::getIndex<ComponentTypes, ComponentTypes...>()] = manager->getComponentContainer<ComponentTypes>()), ...);
-			mArrays[sizeof...(ComponentTypes)] = manager->getComponentContainer<T>();
+		template<typename RegistryType>
+		explicit ComponentArraysIterator(RegistryType* manager, EntitiesRanges&& ranges = {}, bool lock = true) {
+			((mArrays[types::getIndex<ComponentTypes, ComponentTypes...>()] = manager->template getComponentContainer<ComponentTypes>()), ...);
+			mArrays[sizeof...(ComponentTypes)] = manager->template getComponentContainer<T>();
 			if (lock) {
-				mLocks = manager->containersReadLock<T, ComponentTypes...>();
+				mLocks = manager->template containersReadLock<T, ComponentTypes...>();
 			}
 
 			mRanges = std::move(ranges);
@@ -347,31 +832,27 @@ namespace ecss {
 			mReflectionHelper = &manager->mReflectionHelper;
 		}
 
-		inline bool valid() const { return mArrays[sizeof...(ComponentTypes)]->size(); }
+		inline bool valid() const { return mArrays[sizeof...(ComponentTypes)] && mArrays[sizeof...(ComponentTypes)]->size(); }
 
 		class Iterator {
 		public:
 			inline Iterator(const std::array<Memory::SectorsArray*, sizeof...(ComponentTypes) + 1>& arrays, size_t idx, const EntitiesRanges& ranges, Memory::ReflectionHelper* reflectionHelper) : mRanges(ranges), mCurIdx(idx) {
-				if (!arrays[sizeof...(ComponentTypes)]->size()) {
+				if (!arrays[sizeof...(ComponentTypes)] || !arrays[sizeof...(ComponentTypes)]->size()) {//frozen or sealed registry gives nullptr for types without container
 					return;
 				}
 
+				//first sector of ranges is found by ids columns seek instead of probing every id of range
 				while (mRanges.size()) {
-					for (auto i = mRanges.front().first; i < mRanges.front().second; i++) {
-						mCurIdx = arrays[sizeof...(ComponentTypes)]->tryGetSectorIdx(mRanges.front().first);
-						if (mCurIdx < arrays[sizeof...(ComponentTypes)]->size()) {
-							break;
-						}
-						mRanges.front().first++;
-					}
-
-					if (mCurIdx < arrays[sizeof...(ComponentTypes)]->size()) {
+					mCurIdx = arrays[sizeof...(ComponentTypes)]->lowerBoundIdx(mRanges.front().first);
+					if (mCurIdx < arrays[sizeof...(ComponentTypes)]->endIdx() && (*arrays[sizeof...(ComponentTypes)])[mCurIdx]->id < mRanges.front().second) {
 						break;
 					}
+
+					mCurIdx = arrays[sizeof...(ComponentTypes)]->endIdx();
 					mRanges.pop_front();
 				}
 
-				mCurrentSector = mCurIdx >= arrays[sizeof...(ComponentTypes)]->size() ? nullptr : (*arrays[sizeof...(ComponentTypes)])[mCurIdx];
+				mCurrentSector = mCurIdx >= arrays[sizeof...(ComponentTypes)]->endIdx() ? nullptr : (*arrays[sizeof...(ComponentTypes)])[mCurIdx];
 
 				if (!mCurrentSector) {
 					return;
@@ -381,67 +862,82 @@ namespace ecss {
 				mGetInfo[mainIdx].array = arrays[mainIdx];
 				mGetInfo[mainIdx].offset = arrays[mainIdx]->getTypeOffset(reflectionHelper->getTypeId<T>());
 				mGetInfo[mainIdx].isMain = true;
-				mGetInfo[mainIdx].size = arrays[mainIdx]->size();
+				mGetInfo[mainIdx].size = arrays[mainIdx]->endIdx();
+				mMainBit = arrays[mainIdx]->getTypeBit(reflectionHelper->getTypeId<T>());
 
 				((
 					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].array = arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]
 					,
-					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].offset = arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]->getTypeOffset(reflectionHelper->getTypeId<ComponentTypes>())
+					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].offset = arrays[types::getIndex<ComponentTypes, ComponentTypes...>()] ? arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]->getTypeOffset(reflectionHelper->getTypeId<ComponentTypes>()) : uint16_t(0)
 					,
 					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].isMain = arrays[mainIdx] == arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]
 					,
-					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].size = arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]->size()
+					mGetInfo[types::getIndex<ComponentTypes, ComponentTypes...>()].size = arrays[types::getIndex<ComponentTypes, ComponentTypes...>()] ? arrays[types::getIndex<ComponentTypes, ComponentTypes...>()]->endIdx() : 0
 					)
 					,
 					...);
+
+				if (!isMainAlive()) {
+					operator++();
+				}
 			}
 
 			template<typename ComponentType>
 			inline ComponentType* getComponent(const EntityId sectorId) {
-				return mGetInfo[types::getIndex<ComponentType, ComponentTypes...>()].isMain ? mCurrentSector->getMember<ComponentType>(mGetInfo[types::getIndex<ComponentType, ComponentTypes...>()].offset) : mGetInfo[types::getIndex<ComponentType, ComponentTypes...>()].array->template getComponentByOffset<ComponentType>(sectorId, mGetInfo[types::getIndex<ComponentType, ComponentTypes...>()].offset);
+				const auto& info = mGetInfo[types::getIndex<ComponentType, ComponentTypes...>()];
+				if (info.isMain) {
+					return mCurrentSector->getMember<ComponentType>(info.offset);
+				}
+
+				return info.array ? info.array->template getComponentByOffset<ComponentType>(sectorId, info.offset) : nullptr;
 			}
 
 			inline std::tuple<EntityId, T*, ComponentTypes*...> operator*() {
 				return std::forward_as_tuple(mCurrentSector->id, (mCurrentSector->getMember<T>(mGetInfo[sizeof...(ComponentTypes)].offset)), getComponent<ComponentTypes>(mCurrentSector->id)...);
 			}
 
-			inline Iterator& operator++() {//todo bug - if ids 1 5 7 but its idxs in array 0 1 2 it will skip it
-				mCurrentSector = (++mCurIdx >= mGetInfo[sizeof...(ComponentTypes)].size ? nullptr : (*(mGetInfo[sizeof...(ComponentTypes)].array))[mCurIdx]);
-				if (mCurrentSector && !mRanges.empty()) {
-					auto& front = mRanges.front();
-					if (mCurrentSector->id >= front.first && mCurrentSector->id < front.second) {
-						return *this;
+			inline Iterator& operator++() {
+				do {
+					mCurIdx = mGetInfo[sizeof...(ComponentTypes)].array->nextIdx(mCurIdx);
+					mCurrentSector = (mCurIdx >= mGetInfo[sizeof...(ComponentTypes)].size ? nullptr : (*(mGetInfo[sizeof...(ComponentTypes)].array))[mCurIdx]);
+					if (mCurrentSector && !mRanges.empty()) {
+						seekRange();
 					}
+				} while (!isMainAlive());
 
+				return *this;
+			}
+
+			inline bool operator!=(const Iterator& other) const { return mCurrentSector != other.mCurrentSector; }
+
+		private:
+			//sector header is already in cache, so dead sectors are skipped without touching members
+			inline bool isMainAlive() const {
+				return !mCurrentSector || mCurrentSector->aliveMask & mMainBit;
+			}
+
+			//skips sectors out of ranges, gap before the next range is skipped with one seek by ids columns, range begin id can be absent in container
+			inline void seekRange() {
+				const auto sectorsArray = mGetInfo[sizeof...(ComponentTypes)].array;
+				while (mCurrentSector) {
+					const auto& front = mRanges.front();
 					if (mCurrentSector->id < front.first) {
-						auto sectorsArray = mGetInfo[sizeof...(ComponentTypes)].array;
-						mCurIdx = sectorsArray->tryGetSectorIdx(front.first);
-						mCurrentSector = sectorsArray->getSectorByIdx(mCurIdx);
-						return *this;
+						mCurIdx = sectorsArray->lowerBoundIdx(front.first);
+						mCurrentSector = mCurIdx >= mGetInfo[sizeof...(ComponentTypes)].size ? nullptr : (*sectorsArray)[mCurIdx];
+						continue;
 					}
 
-					if (mCurrentSector->id >= front.second) {
-						if (mRanges.size() == 1) {
-							mCurrentSector = nullptr;
-							mRanges.pop_front();
-							return *this;
-						}
-						else {
-							mRanges.pop_front();
-							if (mCurrentSector->id == mRanges.front().first) {
-								return *this;
-							}
-							return operator++();
-						}
+					if (mCurrentSector->id < front.second) {
+						return;
 					}
-				}
 
-				return *this;
+					mRanges.pop_front();
+					if (mRanges.empty()) {
+						mCurrentSector = nullptr;
+					}
+				}
 			}
 
-			inline bool operator!=(const Iterator& other) const { return mCurrentSector != other.mCurrentSector; }
-
-		private:
 			struct ObjectGetterMeta {
 				bool isMain = false;
 				uint16_t offset = 0;
@@ -455,10 +951,11 @@ namespace ecss {
 
 			size_t mCurIdx = 0;
 			Memory::Sector* mCurrentSector = nullptr;
+			uint32_t mMainBit = 0;
 		};
 
-		inline Iterator begin() { return { mArrays, 0, mRanges, mReflectionHelper }; }
-		inline Iterator end() { return { mArrays, mArrays[sizeof...(ComponentTypes)]->size(), {}, mReflectionHelper }; }
+		inline Iterator begin() { return { mArrays, mArrays[sizeof...(ComponentTypes)] ? mArrays[sizeof...(ComponentTypes)]->beginIdx() : 0, mRanges, mReflectionHelper }; }
+		inline Iterator end() { return { mArrays, mArrays[sizeof...(ComponentTypes)] ? mArrays[sizeof...(ComponentTypes)]->endIdx() : 0, {}, mReflectionHelper }; }
 
 	private:
 		std::array<Memory::SectorsArray*, sizeof...(ComponentTypes) + 1> mArrays;
@@ -0,0 +1,88 @@
+﻿#pragma once
+
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Registry.h"
+
+namespace ecss {
+	/*
+		pool of configured registries for worlds which are created and destroyed with high rate
+
+		configure callback is called once for every new registry (initCustomComponentsContainer, reserve, etc.),
+		released registries are reset with keepCapacity, so containers groupings, warmed chunks, sectors maps and type tables are reused by next acquire
+
+		acquire and release only take and put pointer to the free list, registry content is destroyed by reset on release
+	*/
+	template<typename ThreadingPolicy = MultiThreaded>
+	class RegistryPool final {
+		RegistryPool(const RegistryPool& other) = delete;
+		RegistryPool& operator=(const RegistryPool& other) = delete;
+
+	public:
+		using RegistryType = BasicRegistry<ThreadingPolicy>;
+		using ConfigureFunc = std::function<void(RegistryType&)>;
+
+		explicit RegistryPool(ConfigureFunc configure, size_t preallocatedCount = 0) : mConfigure(std::move(configure)) {
+			for (size_t i = 0; i < preallocatedCount; i++) {
+				mFree.push_back(create());
+			}
+		}
+
+		RegistryType* acquire() {
+			std::unique_lock lock(mMutex);
+			if (mFree.empty()) {
+				return create();
+			}
+
+			const auto registry = mFree.back();
+			mFree.pop_back();
+			return registry;
+		}
+
+		//registry should be acquired from this pool and shouldn't be used after release
+		void release(RegistryType* registry) {
+			if (!registry) {
+				return;
+			}
+
+			registry->waitSnapshot();
+			registry->unfreeze();
+			registry->reset(true);
+
+			std::unique_lock lock(mMutex);
+			assert(std::find_if(mRegistries.begin(), mRegistries.end(), [registry](const auto& owned) { return owned.get() == registry; }) != mRegistries.end() && "registry doesn't belong to the pool");
+			mFree.push_back(registry);
+		}
+
+		size_t size() const {
+			std::unique_lock lock(mMutex);
+			return mRegistries.size();
+		}
+
+		size_t freeCount() const {
+			std::unique_lock lock(mMutex);
+			return mFree.size();
+		}
+
+	private:
+		RegistryType* create() {
+			const auto registry = mRegistries.emplace_back(std::make_unique<RegistryType>()).get();
+			if (mConfigure) {
+				mConfigure(*registry);
+			}
+
+			return registry;
+		}
+
+	private:
+		ConfigureFunc mConfigure;
+
+		std::vector<std::unique_ptr<RegistryType>> mRegistries;
+		std::vector<RegistryType*> mFree;
+		mutable std::conditional_t<ThreadingPolicy::THREAD_SAFE, std::mutex, NullMutex> mMutex;
+	};
+}
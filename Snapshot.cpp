@@ -0,0 +1,294 @@
+﻿#include "Snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace ecss {
+	namespace {
+		constexpr uint32_t MAX_UNLOCKED_ATTEMPTS = 3;
+
+		template<typename T>
+		bool read(std::ifstream& file, T& value) {
+			return static_cast<bool>(file.read(static_cast<char*>(static_cast<void*>(&value)), sizeof(T)));
+		}
+
+		template<typename T>
+		void write(std::ofstream& file, const T& value) {
+			file.write(static_cast<const char*>(static_cast<const void*>(&value)), sizeof(T));
+		}
+
+		bool isCaptured(const std::vector<std::pair<EntityId, EntityId>>& entities, SectorId id) {
+			const auto it = std::upper_bound(entities.begin(), entities.end(), id, [](SectorId id, const std::pair<EntityId, EntityId>& range) { return id < range.first; });
+			return it != entities.begin() && id < std::prev(it)->second;
+		}
+
+		/*
+		  returns false if container structure was changed while it was written
+		  only sectors of entities captured with the snapshot are written, so components added to ids taken after snapshot began don't get into the file
+		*/
+		bool writeContainer(std::ofstream& file, const Snapshot::ContainerSource& source, const std::vector<std::pair<EntityId, EntityId>>& entities, std::vector<char>& staging, bool lockWhole) {
+			const auto array = source.array;
+
+			auto lock = source.mutex ? std::shared_lock(*source.mutex) : std::shared_lock<std::shared_mutex>();
+			lockWhole |= !source.mutex;
+			const auto version = array->getStructureVersion();
+			const auto size = array->size();
+			const auto& meta = array->getSectorData();
+
+			write(file, static_cast<uint16_t>(meta.membersLayout.size()));
+			for (auto& [typeId, offset] : meta.membersLayout) {
+				write(file, typeId);
+				write(file, offset);
+			}
+			write(file, meta.sectorSize);
+			const auto sizePos = file.tellp();
+			write(file, size);
+			uint32_t written = 0;
+
+			const size_t sectorSize = meta.sectorSize;
+			const auto chunksCount = array->chunksCount();
+			staging.resize(std::max(staging.size(), array->getChunkSize() * sectorSize));
+
+			for (uint32_t pos = 0; pos < chunksCount; pos++) {
+				if (!lockWhole) {
+					if (pos) {
+						lock.lock();
+					}
+
+					if (array->getStructureVersion() != version) {
+						return false;
+					}
+				}
+
+				const auto [sectors, count] = array->getChunkSpan(pos);
+				const auto ids = array->getChunkIds(pos);
+				const auto data = static_cast<const char*>(static_cast<const void*>(sectors));
+				size_t staged = 0;
+				for (uint32_t i = 0; i < count;) {//copies runs of captured sectors
+					if (!isCaptured(entities, ids[i])) {
+						i++;
+						continue;
+					}
+
+					auto end = i + 1;
+					while (end < count && isCaptured(entities, ids[end])) {
+						end++;
+					}
+
+					std::memcpy(staging.data() + staged * sectorSize, data + i * sectorSize, (end - i) * sectorSize);
+					staged += end - i;
+					i = end;
+				}
+
+				if (!lockWhole) {
+					lock.unlock();
+				}
+
+				file.write(staging.data(), static_cast<std::streamsize>(staged * sectorSize));
+				written += static_cast<uint32_t>(staged);
+			}
+
+			if (written != size) {
+				const auto sectionEnd = file.tellp();
+				file.seekp(sizePos);
+				write(file, written);
+				file.seekp(sectionEnd);
+			}
+
+			return true;
+		}
+	}
+
+	AsyncSnapshotWriter::AsyncSnapshotWriter(std::string path, std::vector<std::pair<ECSType, uint64_t>>&& types, std::vector<std::pair<EntityId, EntityId>>&& entities, std::vector<Snapshot::ContainerSource>&& containers)
+		: mPath(std::move(path)), mTypes(std::move(types)), mEntities(std::move(entities)), mContainers(std::move(containers)) {
+		mThread = std::thread(&AsyncSnapshotWriter::run, this);
+	}
+
+	AsyncSnapshotWriter::~AsyncSnapshotWriter() {
+		wait();
+	}
+
+	bool AsyncSnapshotWriter::wait() {
+		if (mThread.joinable()) {
+			mThread.join();
+		}
+
+		return mSucceeded;
+	}
+
+	void AsyncSnapshotWriter::run() {
+		std::ofstream file(mPath, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			mFinished = true;
+			return;
+		}
+
+		write(file, Snapshot::MAGIC);
+		write(file, Snapshot::VERSION);
+
+		write(file, static_cast<uint32_t>(mTypes.size()));
+		for (auto& [type, stableId] : mTypes) {
+			write(file, type);
+			write(file, stableId);
+		}
+
+		write(file, static_cast<uint32_t>(mEntities.size()));
+		for (auto& [first, second] : mEntities) {
+			write(file, first);
+			write(file, second);
+		}
+
+		write(file, static_cast<uint32_t>(mContainers.size()));
+
+		std::vector<char> staging;
+		for (auto& container : mContainers) {
+			const auto sectionBegin = file.tellp();
+			for (auto attempt = 0u; !writeContainer(file, container, mEntities, staging, attempt >= MAX_UNLOCKED_ATTEMPTS); attempt++) {
+				file.seekp(sectionBegin);
+			}
+		}
+
+		//rewritten sections can be shorter than previous attempt, so cut the tail
+		const auto end = file.tellp();
+		file.close();
+		mSucceeded = !file.fail();
+
+		std::error_code error;
+		std::filesystem::resize_file(mPath, static_cast<uintmax_t>(end), error);
+
+		mFinished = true;
+	}
+
+	StreamingSnapshotLoader::StreamingSnapshotLoader(std::string path, uint32_t sectorsPerPiece, uint32_t maxPendingPieces)
+		: mPath(std::move(path)), mSectorsPerPiece(std::max(sectorsPerPiece, 1u)), mMaxPendingPieces(std::max(maxPendingPieces, 1u)) {
+		mThread = std::thread(&StreamingSnapshotLoader::run, this);
+	}
+
+	StreamingSnapshotLoader::~StreamingSnapshotLoader() {
+		{
+			std::unique_lock lock(mQueueMutex);//reader checks mStop under the queue mutex, so it can't miss notification between check and wait
+			mStop = true;
+		}
+		mQueueCondition.notify_all();
+		if (mThread.joinable()) {
+			mThread.join();
+		}
+	}
+
+	bool StreamingSnapshotLoader::isFinished() {
+		if (!mReadFinished) {
+			return false;
+		}
+
+		std::unique_lock lock(mQueueMutex);
+		return mPieces.empty() && !mHasEntities;
+	}
+
+	bool StreamingSnapshotLoader::tryPopEntities(std::vector<std::pair<EntityId, EntityId>>& entities) {
+		std::unique_lock lock(mQueueMutex);
+		if (!mHasEntities) {
+			return false;
+		}
+
+		entities = std::move(mEntities);
+		mHasEntities = false;
+		return true;
+	}
+
+	bool StreamingSnapshotLoader::tryPopPiece(Piece& piece) {
+		{
+			std::unique_lock lock(mQueueMutex);
+			if (mPieces.empty() || mHasEntities) {//pieces are given only after entities and types dictionary are taken
+				return false;
+			}
+
+			piece = std::move(mPieces.front());
+			mPieces.pop_front();
+		}
+
+		mQueueCondition.notify_all();
+		return true;
+	}
+
+	void StreamingSnapshotLoader::push(Piece&& piece) {
+		std::unique_lock lock(mQueueMutex);
+		mQueueCondition.wait(lock, [this] { return mStop || mPieces.size() < mMaxPendingPieces; });
+		mPieces.push_back(std::move(piece));
+	}
+
+	void StreamingSnapshotLoader::run() {
+		std::ifstream file(mPath, std::ios::binary);
+
+		uint32_t magic = 0;
+		uint32_t version = 0;
+		uint32_t typesCount = 0;
+		if (!file || !read(file, magic) || !read(file, version) || magic != Snapshot::MAGIC || version != Snapshot::VERSION || !read(file, typesCount)) {
+			mFailed = true;
+			mReadFinished = true;
+			return;
+		}
+
+		std::vector<std::pair<ECSType, uint64_t>> types(typesCount);
+		for (auto& [type, stableId] : types) {
+			read(file, type);
+			read(file, stableId);
+		}
+
+		uint32_t rangesCount = 0;
+		if (!read(file, rangesCount)) {
+			mFailed = true;
+			mReadFinished = true;
+			return;
+		}
+
+		std::vector<std::pair<EntityId, EntityId>> entities(rangesCount);
+		for (auto& [first, second] : entities) {
+			read(file, first);
+			read(file, second);
+		}
+
+		{
+			std::unique_lock lock(mQueueMutex);
+			mTypes = std::move(types);
+			mEntities = std::move(entities);
+			mHasEntities = true;
+		}
+
+		uint32_t containersCount = 0;
+		read(file, containersCount);
+
+		for (auto container = 0u; container < containersCount && file && !mStop; container++) {
+			uint16_t membersCount = 0;
+			read(file, membersCount);
+
+			std::vector<std::pair<ECSType, uint16_t>> membersLayout(membersCount);
+			for (auto& [typeId, offset] : membersLayout) {
+				read(file, typeId);
+				read(file, offset);
+			}
+
+			uint16_t sectorSize = 0;
+			uint32_t sectorsCount = 0;
+			read(file, sectorSize);
+			read(file, sectorsCount);
+
+			for (uint32_t begin = 0; begin < sectorsCount && file && !mStop; begin += mSectorsPerPiece) {
+				Piece piece;
+				piece.membersLayout = membersLayout;
+				piece.sectorSize = sectorSize;
+				piece.count = std::min(mSectorsPerPiece, sectorsCount - begin);
+				piece.data.resize(static_cast<size_t>(piece.count) * sectorSize);
+				file.read(piece.data.data(), static_cast<std::streamsize>(piece.data.size()));
+
+				if (file) {
+					push(std::move(piece));
+				}
+			}
+		}
+
+		mFailed = !file;
+		mReadFinished = true;
+	}
+}
@@ -0,0 +1,133 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory/SectorsArray.h"
+
+namespace ecss {
+	/*
+		snapshot file layout (native endianness, all containers should contain only trivially copyable types)
+
+		[header]			uint32 magic, uint32 version
+		[types]				uint32 typesCount, typesCount * { ECSType type, uint64 stableId } - dictionary of types ids used in the file
+		[entities]			uint32 rangesCount, rangesCount * { EntityId first, EntityId second }
+		[containers]		uint32 containersCount
+			[container]		uint16 membersCount, membersCount * { ECSType type, uint16 offset }, uint16 sectorSize, uint32 sectorsCount
+							sectorsCount * sectorSize raw sectors data, sorted by sector id
+	*/
+	namespace Snapshot {
+		constexpr uint32_t MAGIC = 0x53534345;//ECSS
+		constexpr uint32_t VERSION = 2;
+
+		struct ContainerSource {
+			Memory::SectorsArray* array = nullptr;
+			std::shared_mutex* mutex = nullptr;//nullptr for containers of single threaded registry
+		};
+	}
+
+	/*
+		writes snapshot from background thread
+
+		container data is copied chunk by chunk under the container read lock into staging buffer of one chunk size, and streamed to disk after lock released,
+		so other threads are blocked at most for one chunk copy at a time, and memory overhead is bounded by the biggest chunk
+
+		if container sectors were moved while the container is being written (structure version changed), container section is rewritten from scratch,
+		after several failed attempts the container is written under one read lock
+
+		entities ranges are captured when snapshot begins and only sectors of captured entities are written, so the file never has components without entity,
+		components of captured entities which are removed before their chunk is copied are missing in the file
+	*/
+	class AsyncSnapshotWriter final {
+		AsyncSnapshotWriter(const AsyncSnapshotWriter& other) = delete;
+		AsyncSnapshotWriter& operator=(const AsyncSnapshotWriter& other) = delete;
+
+	public:
+		AsyncSnapshotWriter(std::string path, std::vector<std::pair<ECSType, uint64_t>>&& types, std::vector<std::pair<EntityId, EntityId>>&& entities, std::vector<Snapshot::ContainerSource>&& containers);
+		~AsyncSnapshotWriter();
+
+		bool isFinished() const { return mFinished; }
+
+		//blocks till writing finished, returns false if file can't be written
+		bool wait();
+
+	private:
+		void run();
+
+	private:
+		std::string mPath;
+		std::vector<std::pair<ECSType, uint64_t>> mTypes;
+		std::vector<std::pair<EntityId, EntityId>> mEntities;
+		std::vector<Snapshot::ContainerSource> mContainers;
+
+		std::atomic<bool> mFinished = false;
+		bool mSucceeded = false;
+
+		std::thread mThread;
+	};
+
+	/*
+		reads snapshot file in pieces of sectorsPerPiece sectors from background thread
+
+		read pieces are queued, queue is bounded by maxPendingPieces so memory overhead is bounded too,
+		pieces should be spliced into registry containers at frame boundaries with Registry::applyStreamedData
+	*/
+	class StreamingSnapshotLoader final {
+		StreamingSnapshotLoader(const StreamingSnapshotLoader& other) = delete;
+		StreamingSnapshotLoader& operator=(const StreamingSnapshotLoader& other) = delete;
+
+	public:
+		struct Piece {
+			std::vector<std::pair<ECSType, uint16_t>> membersLayout;
+			uint16_t sectorSize = 0;
+			uint32_t count = 0;
+			std::vector<char> data;
+		};
+
+		explicit StreamingSnapshotLoader(std::string path, uint32_t sectorsPerPiece = 10240, uint32_t maxPendingPieces = 4);
+		~StreamingSnapshotLoader();
+
+		//file is read and all pieces are taken
+		bool isFinished();
+		bool isFailed() const { return mFailed; }
+
+		bool tryPopEntities(std::vector<std::pair<EntityId, EntityId>>& entities);
+		bool tryPopPiece(Piece& piece);
+
+		//types dictionary of the file, {type, stableId}, valid after tryPopEntities returned true
+		const std::vector<std::pair<ECSType, uint64_t>>& getTypes() const { return mTypes; }
+
+		//file type id -> registry type id, empty if file ids match registry ids and pieces don't need remap
+		void setTypesRemap(std::vector<ECSType>&& remap) { mTypesRemap = std::move(remap); }
+		const std::vector<ECSType>& getTypesRemap() const { return mTypesRemap; }
+
+	private:
+		void run();
+		void push(Piece&& piece);
+
+	private:
+		std::string mPath;
+		const uint32_t mSectorsPerPiece;
+		const uint32_t mMaxPendingPieces;
+
+		std::mutex mQueueMutex;
+		std::condition_variable mQueueCondition;
+		std::deque<Piece> mPieces;
+		std::vector<std::pair<ECSType, uint64_t>> mTypes;
+		std::vector<ECSType> mTypesRemap;
+		std::vector<std::pair<EntityId, EntityId>> mEntities;
+		bool mHasEntities = false;
+
+		std::atomic<bool> mStop = false;
+		std::atomic<bool> mReadFinished = false;
+		std::atomic<bool> mFailed = false;
+
+		std::thread mThread;
+	};
+}
@@ -0,0 +1,209 @@
+﻿#pragma once
+
+#include <cstring>
+#include <functional>
+#include <shared_mutex>
+#include <vector>
+
+#include "memory/SectorsArray.h"
+
+namespace ecss {
+	/*
+		cached permutation of container sectors, ordered by user key calculated from component T
+		storage is not touched - view keeps only pairs {key, sectorId}, so sectors can be shifted inside the container freely
+
+		on every update keys are recalculated, dead sectors dropped and new ones appended to the tail,
+		after that permutation is sorted again:
+			- if only few elements are out of order - insertion sort over previous order (almost sorted input, ~O(n))
+			- otherwise - LSD radix sort by key bytes
+
+		sort is stable, so sectors with equal keys keep previous relative order (and id order for new ones)
+
+		view can be iterated through Registry::forEachSorted like a normal forEach query
+	*/
+	template<typename T, typename Key>
+	class SortedView final {
+		static_assert(std::is_arithmetic_v<Key>, "SortedView key should be arithmetic type, it is used for radix sort");
+
+	public:
+		using KeyFunc = std::function<Key(const T&)>;
+
+		struct Entry {
+			Key key;
+			SectorId id;
+		};
+
+		explicit SortedView(KeyFunc keyFunc, uint32_t insertionSortThreshold = 64) : mKeyFunc(std::move(keyFunc)), mInsertionSortThreshold(insertionSortThreshold) {}
+
+		//recalculates keys and restores order, should be called under container read lock
+		void update(Memory::SectorsArray* array, uint16_t offset) {
+			if (mKnown.size() < array->entitiesCapacity()) {
+				mKnown.resize(array->entitiesCapacity(), false);
+			}
+
+			uint32_t disorder = 0;
+			size_t alive = 0;
+			for (auto& entry : mOrder) {
+				const auto sector = array->tryGetSector(entry.id);
+				const auto member = sector ? sector->template getMember<T>(offset) : nullptr;
+				if (!member) {
+					mKnown[entry.id] = false;
+					continue;
+				}
+
+				entry.key = mKeyFunc(*member);
+				if (alive && mOrder[alive - 1].key > entry.key) {
+					disorder++;
+				}
+				mOrder[alive++] = entry;
+			}
+			mOrder.resize(alive);
+
+			const auto prevSize = mOrder.size();
+			for (auto i = array->beginIdx(); i < array->endIdx(); i = array->nextIdx(i)) {
+				const auto sector = array->getSectorByIdx(i);
+				if (mKnown[sector->id]) {
+					continue;
+				}
+
+				if (const auto member = sector->template getMember<T>(offset)) {
+					mKnown[sector->id] = true;
+					mOrder.push_back({ mKeyFunc(*member), sector->id });
+				}
+			}
+			disorder += static_cast<uint32_t>(mOrder.size() - prevSize);
+
+			if (!disorder) {
+				return;
+			}
+
+			if (disorder <= mInsertionSortThreshold) {
+				insertionSort();
+			}
+			else {
+				radixSort();
+			}
+		}
+
+		//drops cached order, next update will sort everything from scratch
+		void invalidate() {
+			mOrder.clear();
+			mKnown.clear();
+		}
+
+		size_t size() const { return mOrder.size(); }
+		bool empty() const { return mOrder.empty(); }
+
+		const std::vector<Entry>& getOrder() const { return mOrder; }
+
+	private:
+		void insertionSort() {
+			for (auto i = 1u; i < mOrder.size(); i++) {
+				if (!(mOrder[i - 1].key > mOrder[i].key)) {
+					continue;
+				}
+
+				auto entry = mOrder[i];
+				auto j = i;
+				for (; j > 0 && mOrder[j - 1].key > entry.key; j--) {
+					mOrder[j] = mOrder[j - 1];
+				}
+				mOrder[j] = entry;
+			}
+		}
+
+		//maps key to unsigned integer with the same order
+		static auto toRadix(Key key) {
+			using Unsigned = std::conditional_t<sizeof(Key) == 8, uint64_t, std::conditional_t<sizeof(Key) == 4, uint32_t, std::conditional_t<sizeof(Key) == 2, uint16_t, uint8_t>>>;
+			constexpr Unsigned signBit = Unsigned(1) << (sizeof(Key) * 8 - 1);
+
+			Unsigned bits;
+			std::memcpy(&bits, &key, sizeof(Key));
+
+			if constexpr (std::is_floating_point_v<Key>) {
+				return static_cast<Unsigned>(bits & signBit ? ~bits : bits | signBit);
+			}
+			else if constexpr (std::is_signed_v<Key>) {
+				return static_cast<Unsigned>(bits ^ signBit);
+			}
+			else {
+				return bits;
+			}
+		}
+
+		void radixSort() {
+			mTmp.resize(mOrder.size());
+
+			for (auto byte = 0u; byte < sizeof(Key); byte++) {
+				size_t counts[256] = {};
+				for (const auto& entry : mOrder) {
+					counts[(toRadix(entry.key) >> (byte * 8)) & 0xFF]++;
+				}
+
+				if (counts[(toRadix(mOrder.front().key) >> (byte * 8)) & 0xFF] == mOrder.size()) {
+					continue;//all keys have the same byte, nothing to do in this pass
+				}
+
+				size_t offset = 0;
+				for (auto& count : counts) {
+					const auto cur = count;
+					count = offset;
+					offset += cur;
+				}
+
+				for (const auto& entry : mOrder) {
+					mTmp[counts[(toRadix(entry.key) >> (byte * 8)) & 0xFF]++] = entry;
+				}
+
+				std::swap(mOrder, mTmp);
+			}
+		}
+
+	private:
+		KeyFunc mKeyFunc;
+		uint32_t mInsertionSortThreshold;
+
+		std::vector<Entry> mOrder;
+		std::vector<Entry> mTmp;
+		std::vector<bool> mKnown;//is sector id already in order
+	};
+
+	/*
+		locked range over SortedView, returned by Registry::forEachSorted
+		iterates through std::tuple<EntityId, T*> in the view order
+	*/
+	template<typename T, typename Key>
+	class SortedViewIterator final {
+	public:
+		SortedViewIterator(const SortedView<T, Key>& view, Memory::SectorsArray* array, uint16_t offset, std::vector<std::shared_lock<std::shared_mutex>>&& locks)
+			: mLocks(std::move(locks)), mView(view), mArray(array), mOffset(offset) {}
+
+		class Iterator {
+		public:
+			inline Iterator(const typename SortedView<T, Key>::Entry* entry, Memory::SectorsArray* array, uint16_t offset) : mEntry(entry), mArray(array), mOffset(offset) {}
+
+			inline std::tuple<EntityId, T*> operator*() const {
+				return { mEntry->id, mArray->getSector(mEntry->id)->template getMember<T>(mOffset) };
+			}
+
+			inline Iterator& operator++() { return ++mEntry, *this; }
+
+			inline bool operator!=(const Iterator& other) const { return mEntry != other.mEntry; }
+
+		private:
+			const typename SortedView<T, Key>::Entry* mEntry = nullptr;
+			Memory::SectorsArray* mArray = nullptr;
+			uint16_t mOffset = 0;
+		};
+
+		inline Iterator begin() const { return { mView.getOrder().data(), mArray, mOffset }; }
+		inline Iterator end() const { return { mView.getOrder().data() + mView.size(), mArray, mOffset }; }
+
+	private:
+		std::vector<std::shared_lock<std::shared_mutex>> mLocks;
+
+		const SortedView<T, Key>& mView;
+		Memory::SectorsArray* mArray = nullptr;
+		uint16_t mOffset = 0;
+	};
+}
@@ -5,6 +5,15 @@
 
 #include <type_traits>
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define ECSS_PREFETCH(address) _mm_prefetch(static_cast<const char*>(static_cast<const void*>(address)), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define ECSS_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define ECSS_PREFETCH(address)
+#endif
+
 namespace ecss {
 	using SectorId = uint32_t;
 	using EntityId = SectorId;
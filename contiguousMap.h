@@ -148,6 +148,10 @@ namespace ecss {
 			return { mData + mSize };
 		}
 
+		size_t size() const {
+			return mSize;
+		}
+
 		void shrinkToFit() {
 			setCapacity(mSize);
 		}
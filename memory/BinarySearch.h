@@ -1,54 +1,55 @@
 ﻿#pragma once
 
+#include <bit>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "SectorsArray.h"
 #include "../Types.h"
 
 namespace ecss::Memory::Utils {
-	__forceinline void* binarySearch(SectorId sectorId, size_t& idx, SectorsArray* sectors) {
-		auto right = sectors->size();
-
-		if (right == 0 || (*sectors)[0]->id > sectorId) {
-			idx = 0;
-			return nullptr;
-		}
-
-		if ((*sectors)[right - 1]->id < sectorId) {
-			idx = right;
-			return nullptr;
-		}
+	//index of the first id not less than sectorId in sorted ids column, binary search narrows the range to few cache lines and the rest is scanned 8 ids at once
+	__forceinline uint32_t lowerBound(const SectorId* ids, uint32_t count, SectorId sectorId) {
+		constexpr uint32_t LINEAR_RANGE = 32;
 
 		uint32_t left = 0u;
-		void* result = nullptr;
-
-		while(true) {
-			if ((*sectors)[left]->id == sectorId) {
-				idx = left;
-				result = (*sectors)[left];
-				break;
+		uint32_t right = count;
+		while (right - left > LINEAR_RANGE) {
+			const auto mid = left + (right - left) / 2;
+			if (ids[mid] < sectorId) {
+				left = mid + 1;
 			}
-
-			const auto dist = right - left;
-			if (dist == 1) {
-				idx = left + 1;
-				break;
-			}
-			
-			const auto mid = left + dist / 2;
-
-			if ((*sectors)[mid]->id > sectorId) {
+			else {
 				right = mid;
-				continue;
 			}
+		}
 
-			if ((*sectors)[mid]->id == sectorId) {
-				idx = mid;
-				result = (*sectors)[mid];
-				break;
+#ifdef __AVX2__
+		//there is no unsigned compare in avx2, so sign bit is flipped for both sides
+		const auto bias = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+		const auto key = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(sectorId)), bias);
+		for (; left + 8 <= right; left += 8) {
+			const auto block = _mm256_xor_si256(_mm256_loadu_si256(static_cast<const __m256i*>(static_cast<const void*>(ids + left))), bias);
+			const auto less = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, block))));
+			if (less != 0xFF) {
+				return left + std::popcount(less);//ids are sorted, so smaller ids are always prefix of the block
 			}
+		}
+#endif
 
-			left = mid;
+		for (; left < right && ids[left] < sectorId; left++) {}
+
+		return left;
+	}
+
+	__forceinline void* binarySearch(SectorId sectorId, size_t& idx, SectorsArray* sectors) {
+		idx = sectors->lowerBoundIdx(sectorId);
+		if (idx >= sectors->endIdx() || (*sectors)[idx]->id != sectorId) {
+			return nullptr;
 		}
 
-		return result;
+		return (*sectors)[idx];
 	}
 }
@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace ecss::Memory {
+	/*
+		component wrapper which keeps two values of T - previous (published) and next (being written)
+
+		which of two buffers is previous is decided by the container front buffer index, so all double buffered components of container are published at once by SectorsArray::swapBuffers
+		writers fill next values, readers from other threads read previous values without locks and copies
+
+		ATTENTION
+		previous value becomes next one after swap, so readers should finish with it before writers start next frame
+		and sectors should not be added or removed while readers hold pointers - structural changes should be done at sync point
+	*/
+	template<typename T>
+	struct DoubleBuffered {
+		DoubleBuffered() = default;
+		explicit DoubleBuffered(const T& value) : buffers{ value, value } {}
+
+		inline T& next(uint8_t frontBuffer) { return buffers[frontBuffer ^ 1]; }
+		inline const T& prev(uint8_t frontBuffer) const { return buffers[frontBuffer]; }
+
+		T buffers[2];
+	};
+}
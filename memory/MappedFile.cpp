@@ -0,0 +1,100 @@
+﻿#include "MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ecss::Memory {
+	MappedFile::~MappedFile() {
+		close();
+	}
+
+#ifdef _WIN32
+	bool MappedFile::create(const std::string& path, size_t size) {
+		close();
+
+		mFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE) {
+			mFile = nullptr;
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		fileSize.QuadPart = static_cast<LONGLONG>(size);
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, fileSize.HighPart, fileSize.LowPart, nullptr);
+		if (!mMapping) {
+			close();
+			return false;
+		}
+
+		mData = static_cast<char*>(MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+		if (!mData) {
+			close();
+			return false;
+		}
+
+		mSize = size;
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (mData) {
+			FlushViewOfFile(mData, mSize);
+			UnmapViewOfFile(mData);
+		}
+
+		if (mMapping) {
+			CloseHandle(mMapping);
+		}
+
+		if (mFile) {
+			CloseHandle(mFile);
+		}
+
+		mData = nullptr;
+		mMapping = nullptr;
+		mFile = nullptr;
+		mSize = 0;
+	}
+#else
+	bool MappedFile::create(const std::string& path, size_t size) {
+		close();
+
+		mFile = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (mFile < 0 || ftruncate(mFile, static_cast<off_t>(size)) != 0) {
+			close();
+			return false;
+		}
+
+		const auto data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+		if (data == MAP_FAILED) {
+			close();
+			return false;
+		}
+
+		mData = static_cast<char*>(data);
+		mSize = size;
+		return true;
+	}
+
+	void MappedFile::close() {
+		if (mData) {
+			msync(mData, mSize, MS_SYNC);
+			munmap(mData, mSize);
+		}
+
+		if (mFile >= 0) {
+			::close(mFile);
+		}
+
+		mData = nullptr;
+		mFile = -1;
+		mSize = 0;
+	}
+#endif
+}
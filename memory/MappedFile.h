@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace ecss::Memory {
+	//read-write file mapping, file is created (or truncated) with the requested size
+	class MappedFile final {
+		MappedFile(const MappedFile& other) = delete;
+		MappedFile& operator=(const MappedFile& other) = delete;
+
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		bool create(const std::string& path, size_t size);
+		//unmaps and flushes data to the file
+		void close();
+
+		inline char* data() const { return mData; }
+		inline size_t size() const { return mSize; }
+
+	private:
+#ifdef _WIN32
+		void* mFile = nullptr;
+		void* mMapping = nullptr;
+#else
+		int mFile = -1;
+#endif
+		char* mData = nullptr;
+		size_t mSize = 0;
+	};
+}
@@ -1,23 +1,39 @@
 ﻿#pragma once
 
+#include <cstring>
 #include <functional>
+#include <string_view>
 
 #include "../Types.h"
 #include "../contiguousMap.h"
 #include "shared_mutex"
 
 namespace ecss::Memory {
+	/*
+		types registry is shared between all registries of the process - type gets its id once on first use and keeps it till the process end,
+		so id lookup is a single static read and any number of registries can be created
+	*/
 	class ReflectionHelper {
 	public:
-		ReflectionHelper() : mCurrentInstance(mHelperInstances++) {	}
-
 		struct FunctionTable {
 			std::function<void(void* dest, void* src)> move;
 			std::function<void(void* dest, void* src)> copy;
 			std::function<void(void* src)> destructor;
-		};
 
-		ContiguousMap<ECSType, FunctionTable> functionsTable;
+			/*range versions for runs of sectors - members are placed with stride bytes between them
+			  dest and src point to the alive flag of the first member (member data is 8 bytes after it), only alive members are processed and alive flags are transferred too
+			  moveN and copyN work like memmove - overlapping runs are allowed
+			*/
+			std::function<void(void* dest, void* src, size_t count, size_t stride)> moveN;
+			std::function<void(void* dest, void* src, size_t count, size_t stride)> copyN;
+			std::function<void(void* src, size_t count, size_t stride)> destroyN;
+
+			bool trivial = false;//type can be copied with memcpy
+			bool trivialDestructor = false;//destructor can be skipped
+			uint16_t size = 0;
+			uint16_t alignment = 0;
+			uint64_t stableId = 0;//persistent type id, doesn't depend on types registration order, used to remap types in snapshots
+		};
 
 		template<typename T>
 		__forceinline ECSType getTypeId() {
@@ -25,46 +41,141 @@ namespace ecss::Memory {
 		}
 
 		ECSType getTypesCount() const {
+			std::shared_lock lock(mtx);
 			return mTypes;
 		}
 
+		//copy of the type functions, table itself can be reallocated by another thread registering new type
+		FunctionTable getFunctionTable(ECSType typeId) const {
+			std::shared_lock lock(mtx);
+			return functionsTable.at(typeId);
+		}
+
+		/*by default stable id is hash of the compiler generated type name, which is the same between runs, but can differ between compilers and namespaces refactoring
+		  stable name allows to keep type id persistent in that cases, name should be unique among registered types
+		*/
+		template<typename T>
+		void setStableName(std::string_view name) {
+			const auto id = getTypeId<T>();
+			std::unique_lock lock(mtx);
+			functionsTable[id].stableId = hashName(name);
+		}
+
+		uint64_t getStableId(ECSType typeId) {
+			std::shared_lock lock(mtx);
+			return typeId < mTypes ? functionsTable[typeId].stableId : 0;
+		}
+
+		//returns INVALID_TYPE if type with such stable id isn't registered
+		ECSType findType(uint64_t stableId) {
+			std::shared_lock lock(mtx);
+			for (ECSType id = 0; id < mTypes; id++) {
+				if (functionsTable[id].stableId == stableId) {
+					return id;
+				}
+			}
+
+			return INVALID_TYPE;
+		}
+
+		//FNV-1a
+		static constexpr uint64_t hashName(std::string_view name) {
+			uint64_t hash = 14695981039346656037ull;
+			for (const auto symbol : name) {
+				hash = (hash ^ static_cast<uint8_t>(symbol)) * 1099511628211ull;
+			}
+
+			return hash;
+		}
+
+		static constexpr inline ECSType INVALID_TYPE = std::numeric_limits<ECSType>::max();
+
 	private:
-		static inline uint8_t mHelperInstances = 0;
-		uint8_t mCurrentInstance = 0;
+		template<typename T>
+		static constexpr std::string_view getTypeName() {
+#if defined(_MSC_VER)
+			return __FUNCSIG__;
+#else
+			return __PRETTY_FUNCTION__;
+#endif
+		}
 
-		ECSType mTypes = 0;
+		static inline ContiguousMap<ECSType, FunctionTable> functionsTable;
+		static inline ECSType mTypes = 0;
 
-		std::shared_mutex mtx;
+		static inline std::shared_mutex mtx;
 
 		template<typename T>
-		__forceinline ECSType initType() {
+		static ECSType initType() {
 			mtx.lock();
 			const ECSType id = mTypes++;
 
 			functionsTable[id].move = [](void* dest, void* src) { new(dest)T(std::move(*static_cast<T*>(src))); };
 			functionsTable[id].copy = [](void* dest, void* src) { new(dest)T(*static_cast<T*>(src)); };
 			functionsTable[id].destructor = [](void* src) { static_cast<T*>(src)->~T(); };
+			functionsTable[id].moveN = [](void* dest, void* src, size_t count, size_t stride) { transferN<T, true>(static_cast<char*>(dest), static_cast<char*>(src), count, stride); };
+			functionsTable[id].copyN = [](void* dest, void* src, size_t count, size_t stride) { transferN<T, false>(static_cast<char*>(dest), static_cast<char*>(src), count, stride); };
+			functionsTable[id].destroyN = [](void* src, size_t count, size_t stride) { destroyN<T>(static_cast<char*>(src), count, stride); };
+			functionsTable[id].trivial = std::is_trivially_copyable_v<T>;
+			functionsTable[id].trivialDestructor = std::is_trivially_destructible_v<T>;
+			functionsTable[id].size = static_cast<uint16_t>(sizeof(T));
+			functionsTable[id].alignment = static_cast<uint16_t>(alignof(T));
+			functionsTable[id].stableId = hashName(getTypeName<T>());
 			mtx.unlock();
 
 			return id;
 		}
 
-		static constexpr inline ECSType INVALID_TYPE = std::numeric_limits<ECSType>::max();
-		template<typename T>
-		__forceinline ECSType getTypeIdImpl() {
-			static std::array<ECSType, 64> types {
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
-				INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE, INVALID_TYPE,
+		template<typename T, bool Move>
+		static void transferN(char* dest, char* src, size_t count, size_t stride) {
+			const auto transfer = [dest, src, stride](size_t i) {
+				const auto destAlive = dest + i * stride;
+				const auto srcAlive = src + i * stride;
+				if constexpr (std::is_trivially_copyable_v<T>) {
+					std::memmove(destAlive, srcAlive, 8 + sizeof(T));//alive flag with data at once, data of dead members doesn't matter
+				}
+				else {
+					*destAlive = *srcAlive;
+					if (*srcAlive) {
+						if constexpr (Move) {
+							new(destAlive + 8)T(std::move(*static_cast<T*>(static_cast<void*>(srcAlive + 8))));
+						}
+						else {
+							new(destAlive + 8)T(*static_cast<T*>(static_cast<void*>(srcAlive + 8)));
+						}
+					}
+				}
 			};
 
-			auto& type = types[mCurrentInstance];
-			return type == INVALID_TYPE ? type = initType<T>(), type : type;
+			if (dest > src) {
+				for (auto i = count; i-- > 0;) {
+					transfer(i);
+				}
+			}
+			else {
+				for (size_t i = 0; i < count; i++) {
+					transfer(i);
+				}
+			}
+		}
+
+		template<typename T>
+		static void destroyN(char* src, size_t count, size_t stride) {
+			for (size_t i = 0; i < count; i++) {
+				const auto alive = src + i * stride;
+				if constexpr (!std::is_trivially_destructible_v<T>) {
+					if (*alive) {
+						static_cast<T*>(static_cast<void*>(alive + 8))->~T();
+					}
+				}
+				*alive = false;
+			}
+		}
+
+		template<typename T>
+		static __forceinline ECSType getTypeIdImpl() {
+			static const ECSType type = initType<T>();//thread safe static initialization
+			return type;
 		}
 	};
 
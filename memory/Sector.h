@@ -19,8 +19,10 @@ namespace ecss::Memory {
 		}
 
 		uint16_t sectorSize = 0;
+		uint16_t alignment = 0;//chunks base alignment, sectorSize is multiple of the biggest member alignment
 
 		ContiguousMap<ECSType, uint16_t> membersLayout;//type and offset from start (can not be 0)
+		ContiguousMap<ECSType, uint32_t> membersBits;//type and its bit in Sector::aliveMask, bits go in membersLayout order
 
 		ContiguousMap<ECSType, ReflectionHelper::FunctionTable> typeFunctionsTable;
 	};
@@ -29,7 +31,7 @@ namespace ecss::Memory {
 	* sector stores data for any custom type in theory, offset to type stores in SectorMetadata struct
 	* --------------------------------------------------------------------------------------------
 	*                                       [SECTOR]
-	* 0x 00                                                         { SectorId  }
+	* 0x 00                                                         { SectorId, aliveMask }
 	* 0x sizeof(Sector)                                         { SomeMember  }
 	* 0x sizeof(Sector + SomeMember)                            { SomeMember1 }
 	* 0x sizeof(Sector + SomeMember + SomeMember1)              { SomeMember2 }
@@ -41,13 +43,20 @@ namespace ecss::Memory {
 	struct Sector {
 		Sector(SectorId id, const ContiguousMap<ECSType, uint16_t>& membersLayout) : id(id) {
 			for (auto& [typeId, offset] : membersLayout) {
-				setAlive(offset, false);
+				setAliveFlag(offset, false);
 			}
 		}
 
 		SectorId id;
+		uint32_t aliveMask = 0;//copy of members alive flags, bit per member (see SectorMetadata::membersBits), placed in header padding
 
-		__forceinline constexpr void setAlive(size_t offset, bool value) {
+		//bit - member bit from SectorMetadata::membersBits
+		__forceinline constexpr void setAlive(size_t offset, uint32_t bit, bool value) {
+			setAliveFlag(offset, value);
+			aliveMask = value ? aliveMask | bit : aliveMask & ~bit;
+		}
+
+		__forceinline constexpr void setAliveFlag(size_t offset, bool value) {
 			*static_cast<uint8_t*>(static_cast<void*>(static_cast<char*>(static_cast<void*>(this)) + offset)) = value;//use first byte which is also reserved for align - to store if object alive
 		}
 
@@ -65,14 +74,8 @@ namespace ecss::Memory {
 			return static_cast<uint8_t*>(static_cast<void*>(static_cast<char*>(static_cast<void*>(this)) + offset + 8));
 		}
 
-		__forceinline bool isSectorAlive(const ContiguousMap<ECSType, uint16_t>& membersLayout) {
-			for (const auto& [type, offset] : membersLayout) {
-				if (isAlive(offset)) {
-					return true;
-				}
-			}
-
-			return false;
+		__forceinline constexpr bool isSectorAlive() const {
+			return aliveMask;
 		}
 	};
 
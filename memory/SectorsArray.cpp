@@ -3,12 +3,45 @@
 #include "BinarySearch.h"
 
 #include <algorithm>
+#include <cstring>
 #include <stdio.h>
 #include <stdlib.h>
 
 namespace ecss::Memory {
+	namespace {
+		void* allocateChunk(size_t size, size_t alignment) {
+			size = (size + alignment - 1) / alignment * alignment;
+#ifdef _MSC_VER
+			const auto chunk = _aligned_malloc(size, alignment);
+#else
+			const auto chunk = std::aligned_alloc(alignment, size);
+#endif
+			return chunk ? std::memset(chunk, 0, size) : nullptr;
+		}
+
+		void freeChunk(void* chunk) {
+#ifdef _MSC_VER
+			_aligned_free(chunk);
+#else
+			std::free(chunk);
+#endif
+		}
+	}
+
 	SectorsArray::~SectorsArray() {
+		releasePending();
+
+		setFrozen(false);
 		clear();
+		shrinkToFit();
+	}
+
+	void SectorsArray::releasePending() {
+		for (auto member = mPendingHead.exchange(nullptr); member;) {
+			const auto next = member->next;
+			member->release(member);
+			member = next;
+		}
 	}
 
 	uint32_t SectorsArray::size() const {
@@ -20,11 +53,61 @@ namespace ecss::Memory {
 	}
 
 	void SectorsArray::clear() {
-		destroySectors(0, size());
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (mChunkLocal) {
+			clearChunkLocal();
+		}
+		else {
+			destroySectors(0, size());
+		}
 
 		mSectorsMap.clear();
 	}
 
+	void SectorsArray::reset(bool keepCapacity) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		releasePending();
+		if (!keepCapacity) {
+			clear();
+			shrinkToFit();//clear of empty array doesn't touch chunks
+			return;
+		}
+
+		for (auto pos = 0u; pos < chunksCount(); pos++) {
+			const auto [sectors, count] = getChunkSpan(pos);
+			const auto sectorBytes = static_cast<char*>(static_cast<void*>(sectors));
+			for (auto& [typeId, functions] : mSectorMeta.typeFunctionsTable) {
+				if (!functions.trivialDestructor) {
+					functions.destroyN(sectorBytes + mSectorMeta.membersLayout.at(typeId), count, mSectorMeta.sectorSize);
+				}
+			}
+		}
+
+		if (mChunkLocal) {
+			while (!mChunkOrder.empty()) {
+				removeChunkFromOrder(static_cast<uint32_t>(mChunkOrder.size() - 1));
+			}
+		}
+
+		std::fill(mSectorsMap.begin(), mSectorsMap.end(), INVALID_ID);
+		mSize = 0;
+		mStructureVersion++;
+	}
+
+	SectorsArray::MemoryUsage SectorsArray::getMemoryUsage() const {
+		MemoryUsage usage;
+		usage.chunksData = static_cast<size_t>(capacity()) * mSectorMeta.sectorSize;
+		usage.sectorsData = static_cast<size_t>(size()) * mSectorMeta.sectorSize;
+		usage.aliveHeaders = static_cast<size_t>(size()) * ((sizeof(Sector) + 8 - 1) / 8 * 8 + 8 * mSectorMeta.membersLayout.size());
+		usage.sectorsMap = mSectorsMap.capacity() * sizeof(SectorId);
+		usage.chunksDirectory = mChunks.capacity() * sizeof(void*) + (mChunkFill.capacity() + mChunkRank.capacity() + mChunkOrder.capacity() + mFreeChunks.capacity()) * sizeof(uint32_t) + mChunkFirstIds.capacity() * sizeof(SectorId);
+		usage.idsColumns = static_cast<size_t>(capacity()) * sizeof(SectorId);
+
+		return usage;
+	}
+
 	uint32_t SectorsArray::capacity() const {
 		return mChunkSize * static_cast<uint32_t>(mChunks.size());
 	}
@@ -33,6 +116,68 @@ namespace ecss::Memory {
 		return mSectorsMap.size();
 	}
 
+	uint32_t SectorsArray::chunksCount() const {
+		return mChunkLocal ? static_cast<uint32_t>(mChunkOrder.size()) : (size() + mChunkSize - 1) / mChunkSize;
+	}
+
+	std::pair<Sector*, uint32_t> SectorsArray::getChunkSpan(uint32_t pos) const {
+		if (mChunkLocal) {
+			const auto chunk = mChunkOrder[pos];
+			return { getSectorByIdx(static_cast<size_t>(chunk) * mChunkSize), mChunkFill[chunk] };
+		}
+
+		const auto begin = pos * mChunkSize;
+		return { getSectorByIdx(begin), std::min(mChunkSize, size() - begin) };
+	}
+
+	const SectorId* SectorsArray::getChunkIds(uint32_t pos) const {
+		return chunkIds(mChunkLocal ? mChunkOrder[pos] : pos);
+	}
+
+	size_t SectorsArray::lowerBoundIdx(SectorId sectorId) const {
+		if (empty()) {
+			return endIdx();
+		}
+
+		if (mChunkLocal) {
+			const auto pos = findChunkPos(sectorId);
+			const auto chunk = mChunkOrder[pos];
+			const auto local = lowerBoundInChunk(chunk, sectorId);
+			if (local < mChunkFill[chunk]) {
+				return static_cast<size_t>(chunk) * mChunkSize + local;
+			}
+
+			return pos + 1 < mChunkOrder.size() ? static_cast<size_t>(mChunkOrder[pos + 1]) * mChunkSize : endIdx();
+		}
+
+		//last chunk with first id not greater than sectorId, chunks are probed by the first id of their column only
+		uint32_t left = 0;
+		uint32_t right = chunksCount();
+		while (left < right) {
+			const auto mid = left + (right - left) / 2;
+			if (chunkIds(mid)[0] <= sectorId) {
+				left = mid + 1;
+			}
+			else {
+				right = mid;
+			}
+		}
+
+		const auto chunk = left ? left - 1 : 0;
+		const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+		return chunkBegin + Utils::lowerBound(chunkIds(chunk), static_cast<uint32_t>(std::min<size_t>(mChunkSize, size() - chunkBegin)), sectorId);
+	}
+
+	bool SectorsArray::isTriviallyCopyable() const {
+		for (auto& [typeId, functions] : mSectorMeta.typeFunctionsTable) {
+			if (!functions.trivial) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 	void SectorsArray::reserve(uint32_t newCapacity) {
 		if (newCapacity <= capacity()) {
 			return;
@@ -44,18 +189,58 @@ namespace ecss::Memory {
 	}
 
 	void SectorsArray::shrinkToFit() {
+		if (mChunkLocal) {
+			//chunks are addressed by index, so only free chunks from the tail can be released
+			while (!mChunks.empty() && mChunkRank.back() == INVALID_ID) {
+				freeChunk(mChunks.back());
+				mFreeChunks.erase(std::find(mFreeChunks.begin(), mFreeChunks.end(), static_cast<uint32_t>(mChunks.size() - 1)));
+				mChunks.pop_back();
+				mChunkFill.pop_back();
+				mChunkRank.pop_back();
+			}
+			mChunks.shrink_to_fit();
+			return;
+		}
+
 		auto last = static_cast<uint32_t>(std::ceil(size() / static_cast<float>(mChunkSize)));
 		const auto size = mChunks.size();
 		for (auto i = last; i < size; i++) {
-			std::free(mChunks.at(i));
+			freeChunk(mChunks.at(i));
 		}
 		mChunks.erase(mChunks.begin() + last, mChunks.end());
 		mChunks.shrink_to_fit();
 	}
 
+	void SectorsArray::shrinkSectorsMap() {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		SectorId maxId = 0;
+		if (mChunkLocal) {
+			if (!mChunkOrder.empty()) {
+				const auto chunk = mChunkOrder.back();
+				maxId = chunkIds(chunk)[mChunkFill[chunk] - 1];
+			}
+		}
+		else if (!empty()) {
+			maxId = chunkIds((size() - 1) / mChunkSize)[(size() - 1) % mChunkSize];
+		}
+
+		const size_t mapSize = empty() ? 0 : static_cast<size_t>(maxId) + 1;
+		if (mapSize < mSectorsMap.size()) {
+			mSectorsMap.resize(mapSize);
+			mSectorsMap.shrink_to_fit();
+		}
+	}
+
 	void SectorsArray::incrementCapacity() {
-		mChunks.emplace_back(calloc(mChunkSize, mSectorMeta.sectorSize));
+		mChunks.emplace_back(allocateChunk(idsColumnOffset() + static_cast<size_t>(mChunkSize) * sizeof(SectorId), mSectorMeta.alignment));
 		mChunks.shrink_to_fit();
+		if (mChunkLocal) {
+			mFreeChunks.push_back(static_cast<uint32_t>(mChunks.size() - 1));
+			mChunkFill.push_back(0);
+			mChunkRank.push_back(INVALID_ID);
+		}
+
 		if (capacity() > entitiesCapacity()) {
 			mSectorsMap.resize(capacity(), INVALID_ID);
 		}
@@ -71,8 +256,19 @@ namespace ecss::Memory {
 			mSectorsMap[sectorInfo->id] = INVALID_ID;
 		}
 
-		shiftDataLeft(begin, count);
+		if (begin % mChunkSize == 0 && count % mChunkSize == 0) {
+			//whole chunks erased - move them to the end instead of shifting data, they will be released by shrinkToFit
+			const auto firstChunk = mChunks.begin() + begin / mChunkSize;
+			std::rotate(firstChunk, firstChunk + count / mChunkSize, mChunks.end());
+			for (auto i = begin; i < size() - count; i++) {
+				setSectorIdx(getSectorByIdx(i)->id, i);
+			}
+		}
+		else {
+			shiftDataLeft(begin, count);
+		}
 		mSize -= static_cast<uint32_t>(count);
+		mStructureVersion++;
 
 		shrinkToFit();
 	}
@@ -81,11 +277,12 @@ namespace ecss::Memory {
 		destroyMember(sector, componentTypeId);
 
 		const auto typeOffset = getTypeOffset(componentTypeId);
-		sector->setAlive(typeOffset, true);
+		sector->setAlive(typeOffset, getTypeBit(componentTypeId), true);
 		return sector->getMemberPtr(typeOffset);
 	}
 
 	Sector* SectorsArray::emplaceSector(size_t pos, const SectorId sectorId) {
+		mStructureVersion++;
 		if (pos < size()) {
 			++mSize;
 			shiftDataRight(pos);
@@ -96,12 +293,23 @@ namespace ecss::Memory {
 		
 
 		const auto sector = new (getSectorByIdx(pos))Sector(sectorId, mSectorMeta.membersLayout);
-		mSectorsMap[sectorId] = static_cast<SectorId>(pos);
+		setSectorIdx(sectorId, pos);
 
 		return sector;
 	}
 
 	void* SectorsArray::acquireSector(const ECSType componentTypeId, const SectorId sectorId) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (mChunkLocal) {
+			if (entitiesCapacity() <= sectorId) {
+				mSectorsMap.resize(sectorId + 1, INVALID_ID);
+			}
+
+			const auto sector = tryGetSector(sectorId);
+			return initSectorMember(sector ? sector : emplaceChunkLocalSector(sectorId), componentTypeId);
+		}
+
 		if (size() >= capacity()) {
 			incrementCapacity();
 		}
@@ -122,8 +330,173 @@ namespace ecss::Memory {
 		return initSectorMember(emplaceSector(idx, sectorId), componentTypeId);
 	}
 
+	bool SectorsArray::hasLayout(const std::vector<std::pair<ECSType, uint16_t>>& membersLayout, uint16_t sectorSize) const {
+		if (sectorSize != mSectorMeta.sectorSize) {
+			return false;
+		}
+
+		size_t i = 0;
+		for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+			if (i >= membersLayout.size() || membersLayout[i].first != typeId || membersLayout[i].second != offset) {
+				return false;
+			}
+			i++;
+		}
+
+		return i == membersLayout.size();
+	}
+
+	void SectorsArray::mergeSectors(const void* sectorsData, uint32_t count) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (!count) {
+			return;
+		}
+
+		if (!isTriviallyCopyable()) {
+			assert(false && "sectors can be merged only into trivially copyable container");
+			return;
+		}
+
+		const size_t sectorSize = mSectorMeta.sectorSize;
+		const auto data = static_cast<const char*>(sectorsData);
+		const auto source = [data, sectorSize](size_t i) { return static_cast<const Sector*>(static_cast<const void*>(data + i * sectorSize)); };
+
+		const auto maxId = source(count - 1)->id;
+		if (entitiesCapacity() <= maxId) {
+			mSectorsMap.resize(maxId + 1, INVALID_ID);
+		}
+
+		//overwrite already existing sectors in place, all other are new
+		std::vector<SectorId> newIds;
+		for (auto i = 0u; i < count; i++) {
+			const auto sector = tryGetSector(source(i)->id);
+			if (sector) {
+				std::memcpy(static_cast<void*>(sector), source(i), sectorSize);
+				restoreAliveMask(sector);
+			}
+			else {
+				newIds.push_back(source(i)->id);
+			}
+		}
+
+		emplaceSectors(newIds);
+
+		for (auto i = 0u; i < count; i++) {
+			if (std::binary_search(newIds.begin(), newIds.end(), source(i)->id)) {
+				const auto sector = getSector(source(i)->id);
+				std::memcpy(static_cast<void*>(sector), source(i), sectorSize);
+				restoreAliveMask(sector);
+			}
+		}
+	}
+
+	void SectorsArray::restoreAliveMask(Sector* sector) const {
+		sector->aliveMask = 0;
+		for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+			if (sector->isAlive(offset)) {
+				sector->aliveMask |= getTypeBit(typeId);
+			}
+		}
+	}
+
+	void SectorsArray::emplaceSectors(const std::vector<SectorId>& sortedIds) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (sortedIds.empty()) {
+			return;
+		}
+
+		if (entitiesCapacity() <= sortedIds.back()) {
+			mSectorsMap.resize(sortedIds.back() + 1, INVALID_ID);
+		}
+
+		uint32_t newCount = 0;
+		for (const auto sectorId : sortedIds) {
+			newCount += mSectorsMap[sectorId] == INVALID_ID;
+		}
+
+		if (!newCount) {
+			return;
+		}
+
+		if (mChunkLocal) {
+			//every new sector is inserted into own chunk, cost is bounded by chunk size
+			for (const auto sectorId : sortedIds) {
+				if (mSectorsMap[sectorId] == INVALID_ID) {
+					emplaceChunkLocalSector(sectorId);
+				}
+			}
+			return;
+		}
+
+		reserve(size() + newCount);
+		mStructureVersion++;
+
+		//backward merge - every existing sector is moved at most once
+		int64_t existing = static_cast<int64_t>(size()) - 1;
+		int64_t incoming = static_cast<int64_t>(sortedIds.size()) - 1;
+		size_t place = size() + newCount - 1;
+		mSize += newCount;
+
+		while (incoming >= 0) {
+			const auto sectorId = sortedIds[incoming];
+			if (mSectorsMap[sectorId] != INVALID_ID && mSectorsMap[sectorId] <= existing) {
+				incoming--;//already exists and not moved yet
+				continue;
+			}
+
+			if (existing >= 0 && getSectorByIdx(existing)->id > sectorId) {
+				relocateSector(getSectorByIdx(existing--), place);
+			}
+			else {
+				new (getSectorByIdx(place))Sector(sectorId, mSectorMeta.membersLayout);
+				setSectorIdx(sectorId, place);
+				incoming--;
+			}
+
+			place--;
+		}
+	}
+
+	void SectorsArray::flushPending() {
+		auto head = mPendingHead.exchange(nullptr, std::memory_order_acquire);
+		if (!head) {
+			return;
+		}
+
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		std::vector<PendingMember*> pending;
+		for (; head; head = head->next) {
+			pending.push_back(head);
+		}
+
+		//stack gives pushes in reverse order, restore it, so the last pushed member for the same sector wins
+		std::reverse(pending.begin(), pending.end());
+		std::stable_sort(pending.begin(), pending.end(), [](const PendingMember* a, const PendingMember* b) { return a->sectorId < b->sectorId; });
+
+		std::vector<SectorId> ids;
+		ids.reserve(pending.size());
+		for (const auto member : pending) {
+			if (ids.empty() || ids.back() != member->sectorId) {
+				ids.push_back(member->sectorId);
+			}
+		}
+
+		emplaceSectors(ids);
+
+		for (const auto member : pending) {
+			const auto place = initSectorMember(getSector(member->sectorId), member->typeId);
+			mSectorMeta.typeFunctionsTable.at(member->typeId).move(place, member->data);
+			member->release(member);
+		}
+	}
+
 	void SectorsArray::destroyMember(const ECSType componentTypeId, const SectorId sectorId) {
-		if (getSectorIdx(sectorId) >= size()) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (tryGetSectorIdx(sectorId) >= endIdx()) {
 			return;
 		}
 
@@ -131,7 +504,7 @@ namespace ecss::Memory {
 		
 		destroyMember(sector, componentTypeId);
 
-		if (!sector->isSectorAlive(mSectorMeta.membersLayout)) {
+		if (!sector->isSectorAlive()) {
 			destroySector(sector);
 		}
 	}
@@ -142,12 +515,14 @@ namespace ecss::Memory {
 			return;
 		}
 
-		sector->setAlive(typeOffset, false);
+		sector->setAlive(typeOffset, getTypeBit(typeId), false);
 		
 		mSectorMeta.typeFunctionsTable.at(typeId).destructor(sector->getMemberPtr(typeOffset));
 	}
 
 	void SectorsArray::destroyMembers(ECSType componentTypeId, std::vector<SectorId>& sectorIds, bool sort) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
 		if (sectorIds.empty()) {
 			return;
 		}
@@ -163,7 +538,7 @@ namespace ecss::Memory {
 			}
 
 			const auto idx = getSectorIdx(sectorId);
-			if (idx >= size()) {
+			if (idx >= endIdx()) {
 				continue;//there is no such entity in container
 			}
 			
@@ -178,21 +553,32 @@ namespace ecss::Memory {
 
 		count = std::min(size() - begin, count);
 
-		for (auto i = begin; i < begin + count; i++) {
-			const auto sector = getSectorByIdx(i);
-			for (auto& [typeId, typeIdx] : mSectorMeta.membersLayout) {
-				destroyMember(sector, typeId);
+		destroySectorsMembers(begin, count);
+		erase(begin, count);
+	}
+
+	void SectorsArray::destroySectorsMembers(size_t begin, size_t count) {
+		for (auto i = begin; i < begin + count;) {
+			const auto run = std::min(mChunkSize - i % mChunkSize, begin + count - i);
+			const auto sectorBytes = static_cast<char*>(static_cast<void*>(getSectorByIdx(i)));
+			for (auto& [typeId, functions] : mSectorMeta.typeFunctionsTable) {
+				functions.destroyN(sectorBytes + mSectorMeta.membersLayout.at(typeId), run, mSectorMeta.sectorSize);
 			}
-			sector->~Sector();
+			i += run;
 		}
-
-		erase(begin, count);
 	}
 
 	void SectorsArray::removeEmptySectors() {
+		assert(!isFrozen() && "frozen container can't be modified");
+
 		if (empty()) {
 			return;
 		}
+
+		if (mChunkLocal) {
+			removeEmptyChunkLocalSectors();
+			return;
+		}
 		//algorithm which will not shift all sectors left every time, but shift only alive sectors to left border till not found empty place
 		//OOOOxOxxxOOxxxxOOxOOOO   0 - start
 		//OOOOx<-OxxxOOxxxxOOxOOOO 0
@@ -208,7 +594,7 @@ namespace ecss::Memory {
 		size_t emptyPos = 0;
 		for (auto i = 0u; i < size(); i++) {
 			auto sector = getSectorByIdx(i);
-			if (!sector->isSectorAlive(mSectorMeta.membersLayout)) {
+			if (!sector->isSectorAlive()) {
 				mSectorsMap[sector->id] = INVALID_ID;
 				sector->~Sector();
 				deleted++;
@@ -222,25 +608,28 @@ namespace ecss::Memory {
 				auto emptyPlace = getSectorByIdx(emptyPos);
 				for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
 					if (!sector->isAlive(offset)) {
-						emptyPlace->setAlive(offset, false);
+						emptyPlace->setAliveFlag(offset, false);
 						continue;
 					}
 
 					mSectorMeta.typeFunctionsTable.at(typeId).move(emptyPlace->getMemberPtr(offset), sector->getMemberPtr(offset));
 
-					emptyPlace->setAlive(offset, true);
+					emptyPlace->setAliveFlag(offset, true);
 				}
 
-				new (emptyPlace)Sector(std::move(*sector));
-				mSectorsMap[emptyPlace->id] = static_cast<SectorId>(emptyPos++);
+				new (emptyPlace)Sector(std::move(*sector));//alive mask is moved with header
+				setSectorIdx(emptyPlace->id, emptyPos++);
 			}
 		}
 
 		mSize -= deleted;
+		mStructureVersion++;
 		shrinkToFit();
 	}
 
 	void SectorsArray::destroySector(const SectorId sectorId) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
 		const auto sector = tryGetSector(sectorId);
 		if (!sector) {
 			return;
@@ -249,60 +638,405 @@ namespace ecss::Memory {
 		destroySector(sector);
 	}
 
+	void SectorsArray::destroySectorsRange(SectorId first, SectorId last) {
+		assert(!isFrozen() && "frozen container can't be modified");
+
+		if (first >= last || empty()) {
+			return;
+		}
+
+		if (mChunkLocal) {
+			destroyChunkLocalRange(first, last);
+			return;
+		}
+
+		size_t begin = 0;
+		size_t end = 0;
+		Utils::binarySearch(first, begin, this);
+		Utils::binarySearch(last, end, this);
+
+		destroySectors(begin, end - begin);
+	}
+
 	void SectorsArray::destroySector(Sector* sector) {
 		for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
 			destroyMember(sector, typeId);
 		}
 
 		sector->~Sector();
-		erase(mSectorsMap[sector->id]);
+		if (mChunkLocal) {
+			eraseChunkLocal(mSectorsMap[sector->id]);
+		}
+		else {
+			erase(mSectorsMap[sector->id]);
+		}
 	}
 
 	void SectorsArray::shiftDataRight(size_t from, size_t count) {
-		for (auto i = size() - 1; i >= from + count; i--) {
-			auto prevAdr = getSectorByIdx(i - count);
-			auto newAdr = getSectorByIdx(i);
+		//runs are taken from the end, so both source and destination runs stay inside of chunks
+		for (size_t end = size(); end > from + count;) {
+			const auto run = std::min({ (end - 1) % mChunkSize + 1, (end - 1 - count) % mChunkSize + 1, end - from - count });
+			moveSectors(end - run, end - run - count, run);
+			end -= run;
+		}
+	}
 
+	void SectorsArray::shiftDataLeft(size_t from, size_t count) {
+		for (auto i = from; i < size() - count;) {
+			const auto run = std::min({ mChunkSize - i % mChunkSize, mChunkSize - (i + count) % mChunkSize, size() - count - i });
+			moveSectors(i, i + count, run);
+			i += run;
+		}
+	}
 
-			for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
-				if (!prevAdr->isAlive(offset)) {
-					newAdr->setAlive(offset, false);
+	void SectorsArray::moveSectors(size_t toIdx, size_t fromIdx, size_t count) {
+		const auto to = static_cast<char*>(static_cast<void*>(getSectorByIdx(toIdx)));
+		const auto from = static_cast<char*>(static_cast<void*>(getSectorByIdx(fromIdx)));
+		for (auto& [typeId, functions] : mSectorMeta.typeFunctionsTable) {
+			const auto offset = mSectorMeta.membersLayout.at(typeId);
+			functions.moveN(to + offset, from + offset, count, mSectorMeta.sectorSize);
+		}
+
+		const auto moveHeader = [this, toIdx, fromIdx](size_t i) {
+			const auto newAdr = getSectorByIdx(toIdx + i);
+			new (newAdr)Sector(std::move(*getSectorByIdx(fromIdx + i)));
+			setSectorIdx(newAdr->id, toIdx + i);
+		};
+
+		if (toIdx > fromIdx) {
+			for (auto i = count; i-- > 0;) {
+				moveHeader(i);
+			}
+		}
+		else {
+			for (size_t i = 0; i < count; i++) {
+				moveHeader(i);
+			}
+		}
+	}
+
+	void SectorsArray::transferSectors(const SectorsArray& other, bool move) {
+		for (size_t i = 0; i < other.mSize;) {
+			const auto run = std::min({ static_cast<size_t>(mChunkSize) - i % mChunkSize, static_cast<size_t>(other.mChunkSize) - i % other.mChunkSize, static_cast<size_t>(other.mSize) - i });
+			const auto to = static_cast<char*>(static_cast<void*>(getSectorByIdx(i)));
+			const auto from = static_cast<char*>(static_cast<void*>(other.getSectorByIdx(i)));
+			for (auto& [typeId, functions] : mSectorMeta.typeFunctionsTable) {
+				const auto offset = mSectorMeta.membersLayout.at(typeId);
+				(move ? functions.moveN : functions.copyN)(to + offset, from + offset, run, mSectorMeta.sectorSize);
+			}
+
+			for (auto j = i; j < i + run; j++) {
+				const auto newAdr = getSectorByIdx(j);
+				new (newAdr)Sector(*other.getSectorByIdx(j));
+				setSectorIdx(newAdr->id, j);
+			}
+			i += run;
+		}
+	}
+
+	void SectorsArray::relocateSector(Sector* from, size_t toIdx) {
+		const auto to = getSectorByIdx(toIdx);
+		for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+			if (!from->isAlive(offset)) {
+				to->setAliveFlag(offset, false);
+				continue;
+			}
+
+			mSectorMeta.typeFunctionsTable.at(typeId).move(to->getMemberPtr(offset), from->getMemberPtr(offset));
+			to->setAliveFlag(offset, true);
+		}
+
+		new (to)Sector(std::move(*from));//alive mask is moved with header
+		setSectorIdx(to->id, toIdx);
+	}
+
+	uint32_t SectorsArray::takeFreeChunk() {
+		if (mFreeChunks.empty()) {
+			incrementCapacity();
+		}
+
+		const auto chunk = mFreeChunks.back();
+		mFreeChunks.pop_back();
+		return chunk;
+	}
+
+	void SectorsArray::insertChunkToOrder(uint32_t pos, uint32_t chunk) {
+		mChunkOrder.insert(mChunkOrder.begin() + pos, chunk);
+		mChunkFirstIds.insert(mChunkFirstIds.begin() + pos, getSectorByIdx(static_cast<size_t>(chunk) * mChunkSize)->id);
+		for (auto i = pos; i < mChunkOrder.size(); i++) {
+			mChunkRank[mChunkOrder[i]] = i;
+		}
+	}
+
+	void SectorsArray::removeChunkFromOrder(uint32_t pos) {
+		const auto chunk = mChunkOrder[pos];
+		mChunkFill[chunk] = 0;
+		mChunkRank[chunk] = INVALID_ID;
+		mFreeChunks.push_back(chunk);
+
+		mChunkOrder.erase(mChunkOrder.begin() + pos);
+		mChunkFirstIds.erase(mChunkFirstIds.begin() + pos);
+		for (auto i = pos; i < mChunkOrder.size(); i++) {
+			mChunkRank[mChunkOrder[i]] = i;
+		}
+	}
+
+	uint32_t SectorsArray::findChunkPos(SectorId sectorId) const {
+		const auto it = std::upper_bound(mChunkFirstIds.begin(), mChunkFirstIds.end(), sectorId);
+		return it == mChunkFirstIds.begin() ? 0 : static_cast<uint32_t>(it - mChunkFirstIds.begin() - 1);
+	}
+
+	uint32_t SectorsArray::lowerBoundInChunk(uint32_t chunk, SectorId sectorId) const {
+		return Utils::lowerBound(chunkIds(chunk), mChunkFill[chunk], sectorId);
+	}
+
+	Sector* SectorsArray::emplaceChunkLocalSector(SectorId sectorId) {
+		mStructureVersion++;
+		mSize++;
+
+		if (mChunkOrder.empty()) {
+			const auto chunk = takeFreeChunk();
+			const auto sector = new (getSectorByIdx(static_cast<size_t>(chunk) * mChunkSize))Sector(sectorId, mSectorMeta.membersLayout);
+			mChunkFill[chunk] = 1;
+			setSectorIdx(sectorId, static_cast<size_t>(chunk) * mChunkSize);
+			insertChunkToOrder(0, chunk);
+			return sector;
+		}
+
+		const auto pos = findChunkPos(sectorId);
+		auto chunk = mChunkOrder[pos];
+		auto local = lowerBoundInChunk(chunk, sectorId);
+
+		if (mChunkFill[chunk] == mChunkSize) {
+			const auto newChunk = takeFreeChunk();
+			const size_t newChunkBegin = static_cast<size_t>(newChunk) * mChunkSize;
+
+			if (local == mChunkSize && pos + 1 == mChunkOrder.size()) {
+				//appending after the last sector - start new chunk instead of split, so growing ids keep chunks full
+				const auto sector = new (getSectorByIdx(newChunkBegin))Sector(sectorId, mSectorMeta.membersLayout);
+				mChunkFill[newChunk] = 1;
+				setSectorIdx(sectorId, newChunkBegin);
+				insertChunkToOrder(pos + 1, newChunk);
+				return sector;
+			}
+
+			//split - upper half goes to the new chunk
+			const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+			const auto half = mChunkSize / 2;
+			for (auto i = half; i < mChunkSize; i++) {
+				relocateSector(getSectorByIdx(chunkBegin + i), newChunkBegin + i - half);
+			}
+			mChunkFill[chunk] = half;
+			mChunkFill[newChunk] = mChunkSize - half;
+			insertChunkToOrder(pos + 1, newChunk);
+
+			if (local > half) {
+				chunk = newChunk;
+				local -= half;
+			}
+		}
+
+		const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+		for (auto i = mChunkFill[chunk]; i > local; i--) {
+			relocateSector(getSectorByIdx(chunkBegin + i - 1), chunkBegin + i);
+		}
+		mChunkFill[chunk]++;
+
+		const auto sector = new (getSectorByIdx(chunkBegin + local))Sector(sectorId, mSectorMeta.membersLayout);
+		setSectorIdx(sectorId, chunkBegin + local);
+		if (local == 0) {
+			mChunkFirstIds[mChunkRank[chunk]] = sectorId;
+		}
+
+		return sector;
+	}
+
+	void SectorsArray::eraseChunkLocal(size_t idx) {
+		eraseChunkLocal(static_cast<uint32_t>(idx / mChunkSize), static_cast<uint32_t>(idx % mChunkSize), 1);
+	}
+
+	void SectorsArray::eraseChunkLocal(uint32_t chunk, uint32_t begin, uint32_t count, bool merge) {
+		if (!count) {
+			return;
+		}
+
+		const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+		for (auto i = begin; i < begin + count; i++) {
+			mSectorsMap[getSectorByIdx(chunkBegin + i)->id] = INVALID_ID;
+		}
+
+		for (auto i = begin + count; i < mChunkFill[chunk]; i++) {
+			relocateSector(getSectorByIdx(chunkBegin + i), chunkBegin + i - count);
+		}
+
+		mChunkFill[chunk] -= count;
+		mSize -= count;
+		mStructureVersion++;
+
+		const auto pos = mChunkRank[chunk];
+		if (!mChunkFill[chunk]) {
+			removeChunkFromOrder(pos);
+			return;
+		}
+
+		if (begin == 0) {
+			mChunkFirstIds[pos] = getSectorByIdx(chunkBegin)->id;
+		}
+
+		if (merge) {
+			tryMergeChunks(pos);
+		}
+	}
+
+	void SectorsArray::tryMergeChunks(uint32_t pos) {
+		if (mChunkFill[mChunkOrder[pos]] >= mChunkSize / 4) {
+			return;
+		}
+
+		//merge with the neighbour if both fit into half of chunk, so merged chunk still has slack
+		for (const auto& [leftPos, rightPos] : { std::pair{ pos, pos + 1 }, std::pair{ pos - 1, pos } }) {
+			if ((pos == 0 && leftPos != pos) || rightPos >= mChunkOrder.size()) {
+				continue;
+			}
+
+			const auto left = mChunkOrder[leftPos];
+			const auto right = mChunkOrder[rightPos];
+			if (mChunkFill[left] + mChunkFill[right] > mChunkSize / 2) {
+				continue;
+			}
+
+			const size_t leftBegin = static_cast<size_t>(left) * mChunkSize;
+			const size_t rightBegin = static_cast<size_t>(right) * mChunkSize;
+			for (auto i = 0u; i < mChunkFill[right]; i++) {
+				relocateSector(getSectorByIdx(rightBegin + i), leftBegin + mChunkFill[left] + i);
+			}
+			mChunkFill[left] += mChunkFill[right];
+			mStructureVersion++;
+
+			removeChunkFromOrder(rightPos);
+			return;
+		}
+	}
+
+	void SectorsArray::clearChunkLocal() {
+		for (const auto chunk : mChunkOrder) {
+			const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+			for (auto i = 0u; i < mChunkFill[chunk]; i++) {
+				const auto sector = getSectorByIdx(chunkBegin + i);
+				for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+					destroyMember(sector, typeId);
+				}
+				sector->~Sector();
+			}
+		}
+
+		while (!mChunkOrder.empty()) {
+			removeChunkFromOrder(static_cast<uint32_t>(mChunkOrder.size() - 1));
+		}
+
+		mSize = 0;
+		mStructureVersion++;
+
+		shrinkToFit();
+	}
+
+	void SectorsArray::removeEmptyChunkLocalSectors() {
+		for (auto pos = 0u; pos < mChunkOrder.size();) {
+			const auto chunk = mChunkOrder[pos];
+			const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+
+			uint32_t alive = 0;
+			for (auto i = 0u; i < mChunkFill[chunk]; i++) {
+				const auto sector = getSectorByIdx(chunkBegin + i);
+				if (!sector->isSectorAlive()) {
+					mSectorsMap[sector->id] = INVALID_ID;
+					sector->~Sector();
 					continue;
 				}
-				
-				const auto oldPlace = prevAdr->getMemberPtr(offset);
-				const auto newPlace = newAdr->getMemberPtr(offset);
-				mSectorMeta.typeFunctionsTable.at(typeId).move(newPlace, oldPlace);
 
-				newAdr->setAlive(offset, true);
+				if (alive != i) {
+					relocateSector(sector, chunkBegin + alive);
+				}
+				alive++;
+			}
+
+			mSize -= mChunkFill[chunk] - alive;
+			mChunkFill[chunk] = alive;
+
+			if (!alive) {
+				removeChunkFromOrder(pos);
+				continue;
 			}
 
-			new (newAdr)Sector(std::move(*prevAdr));
-			mSectorsMap[newAdr->id] = static_cast<SectorId>(i);
+			mChunkFirstIds[pos] = getSectorByIdx(chunkBegin)->id;
+			pos++;
 		}
+
+		mStructureVersion++;
+		shrinkToFit();
 	}
 
-	void SectorsArray::shiftDataLeft(size_t from, size_t count) {
-		for (auto i = from; i < size() - count; i++) {
-			auto newAdr = getSectorByIdx(i);
-			auto prevAdr = getSectorByIdx(i + count);
+	void SectorsArray::destroyChunkLocalRange(SectorId first, SectorId last) {
+		auto pos = findChunkPos(first);
+		while (pos < mChunkOrder.size() && mChunkFirstIds[pos] < last) {
+			const auto chunk = mChunkOrder[pos];
+			const auto begin = lowerBoundInChunk(chunk, first);
+			const auto end = lowerBoundInChunk(chunk, last);
+
+			const size_t chunkBegin = static_cast<size_t>(chunk) * mChunkSize;
+			for (auto i = begin; i < end; i++) {
+				const auto sector = getSectorByIdx(chunkBegin + i);
+				for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+					destroyMember(sector, typeId);
+				}
+				sector->~Sector();
+			}
+
+			//no merges here, otherwise sectors of the next chunk could be moved before the current position
+			eraseChunkLocal(chunk, begin, end - begin, false);
+			if (mChunkRank[chunk] != INVALID_ID) {
+				pos++;
+			}
+		}
+	}
+
+	void SectorsArray::copyChunkLocal(const SectorsArray& other, bool move) {
+		clear();
+		reserve(other.capacity());
+
+		for (auto i = other.beginIdx(); i < other.endIdx(); i = other.nextIdx(i)) {
+			const auto prevAdr = other.getSectorByIdx(i);
+			const auto newAdr = getSectorByIdx(i);
 
 			for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
 				if (!prevAdr->isAlive(offset)) {
-					newAdr->setAlive(offset, false);
+					newAdr->setAliveFlag(offset, false);
 					continue;
 				}
 
-				const auto oldPlace = prevAdr->getMemberPtr(offset);
-				const auto newPlace = newAdr->getMemberPtr(offset);
-				mSectorMeta.typeFunctionsTable.at(typeId).move(newPlace, oldPlace);
-				
-				newAdr->setAlive(offset, true);
+				const auto& functions = mSectorMeta.typeFunctionsTable.at(typeId);
+				(move ? functions.move : functions.copy)(newAdr->getMemberPtr(offset), prevAdr->getMemberPtr(offset));
+				newAdr->setAliveFlag(offset, true);
 			}
 
-			new (newAdr)Sector(std::move(*prevAdr));
-			mSectorsMap[newAdr->id] = static_cast<SectorId>(i);
+			new (newAdr)Sector(*prevAdr);//alive mask is copied with header
+			chunkIds(i / mChunkSize)[i % mChunkSize] = prevAdr->id;
 		}
-	}
 
+		mSectorsMap = other.mSectorsMap;
+		mSize = other.mSize;
+		mStructureVersion++;
+
+		mChunkOrder = other.mChunkOrder;
+		mChunkFirstIds = other.mChunkFirstIds;
+		std::copy(other.mChunkFill.begin(), other.mChunkFill.end(), mChunkFill.begin());
+		std::copy(other.mChunkRank.begin(), other.mChunkRank.end(), mChunkRank.begin());
+
+		mFreeChunks.clear();
+		for (auto chunk = 0u; chunk < mChunks.size(); chunk++) {
+			if (mChunkRank[chunk] == INVALID_ID) {
+				mFreeChunks.push_back(chunk);
+			}
+		}
+	}
 }
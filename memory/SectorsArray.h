@@ -1,12 +1,49 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <map>
 
+#include "DoubleBuffered.h"
 #include "Sector.h"
 #include "Reflection.h"
 
 namespace ecss::Memory {
+	constexpr uint16_t CACHE_LINE_SIZE = 64;
+	constexpr size_t MAX_SECTOR_MEMBERS = 32;//bits in Sector::aliveMask
+
+	enum SectorsArrayFlags : uint8_t {
+		DEFAULT = 0,
+		CACHE_LINE_STRIDE = 1 << 0,//pads sector size to the cache line, so sectors processed from different threads never share one line
+		/*every chunk keeps its own fill count and slack space, like B+tree leaf
+		  insert and erase shift sectors only inside one chunk, full chunk splits in half, sparse neighbour chunks merge
+		  chunks are ordered by sector ids through the chunks directory, so sector indices are not contiguous anymore - use beginIdx/nextIdx/endIdx to iterate
+		*/
+		CHUNK_LOCAL = 1 << 1,
+	};
+
+	//member moved to the container from another thread, waits in container pending queue till flushPending
+	struct PendingMember {
+		PendingMember* next = nullptr;
+		void* data = nullptr;
+		void(*release)(PendingMember*) = nullptr;
+		SectorId sectorId = INVALID_ID;
+		ECSType typeId = 0;
+	};
+
+	template<typename T>
+	struct PendingMemberOf final : PendingMember {
+		template<typename U>
+		PendingMemberOf(U&& value) : value(std::forward<U>(value)) {
+			data = &this->value;
+			release = [](PendingMember* member) { delete static_cast<PendingMemberOf*>(member); };
+		}
+
+		T value;
+	};
 
 	/// <summary>
 	/// data container with sectors of custom data in it
@@ -21,44 +58,29 @@ namespace ecss::Memory {
 	class SectorsArray final {
 	public:
 		SectorsArray& operator=(const SectorsArray& other) {
-			const bool isSame = other.mSectorMeta.sectorSize == mSectorMeta.sectorSize;
-			if (!isSame) {
-				assert(isSame && "wrong source sectors array type");
+			if (!hasSameLayout(other)) {
+				assert(false && "wrong source sectors array type");
 				return *this;
 			}
-			
 
 			if (this == &other) {
 				return *this;
 			}
 
+			if (mChunkLocal) {
+				copyChunkLocal(other, false);
+				return *this;
+			}
+
 			if (mSize > other.mSize) {
 				destroySectors(other.mSize, mSize - other.mSize);
 			}
 
 			reserve(other.mSize);
+			mStructureVersion++;
 			mSectorsMap = other.mSectorsMap;
 			mSize = other.mSize;
-			for (auto i = 0u; i < other.mSize; i++) {
-				auto newAdr = getSectorByIdx(i);
-				auto prevAdr = other.getSectorByIdx(i);
-
-				for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
-					if (!prevAdr->isAlive(offset)) {
-						newAdr->setAlive(offset, false);
-						continue;
-					}
-
-					const auto oldPlace = prevAdr->getMemberPtr(offset);
-					const auto newPlace = newAdr->getMemberPtr(offset);
-					mSectorMeta.typeFunctionsTable.at(typeId).copy(newPlace, oldPlace);
-
-					newAdr->setAlive(offset, true);
-				}
-
-				new (newAdr)Sector(*prevAdr);
-				//mSectorsMap[newAdr->id] = static_cast<SectorId>(i);
-			}
+			transferSectors(other, false);
 
 			return *this;
 		}
@@ -68,48 +90,63 @@ namespace ecss::Memory {
 				return *this;
 			}
 
+			if (mChunkLocal) {
+				if (!hasSameLayout(other)) {
+					assert(false && "wrong source sectors array type");
+					return *this;
+				}
+
+				copyChunkLocal(other, true);
+				other.clear();//moved from members are destroyed, other array stays valid and empty like in default layout
+				return *this;
+			}
+
 			if (mSize > other.mSize) {
 				destroySectors(other.mSize, mSize - other.mSize);
 			}
 
 			reserve(other.mSize);
+			mStructureVersion++;
 			mSectorsMap = std::move(other.mSectorsMap);
 			mSize = other.mSize;
-			for (auto i = 0u; i < other.mSize; i++) {
-				auto newAdr = getSectorByIdx(i);
-				auto prevAdr = other.getSectorByIdx(i);
-
-				for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
-					if (!prevAdr->isAlive(offset)) {
-						newAdr->setAlive(offset, false);
-						continue;
-					}
+			transferSectors(other, true);
 
-					const auto oldPlace = prevAdr->getMemberPtr(offset);
-					const auto newPlace = newAdr->getMemberPtr(offset);
-					mSectorMeta.typeFunctionsTable.at(typeId).move(newPlace, oldPlace);
-
-					newAdr->setAlive(offset, true);
-				}
-
-				new (newAdr)Sector(std::move(*prevAdr));
-				mSectorsMap[newAdr->id] = static_cast<SectorId>(i);
-			}
+			//moved from members are destroyed, other array stays valid and empty
+			other.destroySectorsMembers(0, other.mSize);
+			other.mSectorsMap.clear();
+			other.mSize = 0;
+			other.mStructureVersion++;
 
 			return *this;
 		}
 
 	private:
+		//chunk local tables (order, first ids, fill) are copied index by index, so chunk size should match too
+		bool hasSameLayout(const SectorsArray& other) const {
+			return other.mSectorMeta.sectorSize == mSectorMeta.sectorSize && other.mChunkLocal == mChunkLocal && (!mChunkLocal || other.mChunkSize == mChunkSize);
+		}
+
 		SectorsArray(const SectorsArray&) = delete;
 		SectorsArray(SectorsArray&&) = delete;
 
-		SectorsArray(uint32_t chunkSize = 10240) : mChunkSize(chunkSize){}
+		SectorsArray(uint32_t chunkSize = 10240, bool chunkLocal = false) : mChunkSize(chunkSize), mChunkLocal(chunkLocal) {
+			assert((!chunkLocal || chunkSize > 1) && "chunk local layout needs at least 2 sectors in chunk");
+		}
 	
 	public:
+		//flags - SectorsArrayFlags
 		template <typename... Types>
-		static inline constexpr SectorsArray* createSectorsArray(ReflectionHelper& reflectionHelper, uint32_t capacity = 0, uint32_t chunkSize = 10240) {
-			const auto array = new SectorsArray(chunkSize);
-			array->fillSectorData<Types...>(reflectionHelper, capacity);
+		static inline constexpr SectorsArray* createSectorsArray(ReflectionHelper& reflectionHelper, uint32_t capacity = 0, uint32_t chunkSize = 10240, uint8_t flags = DEFAULT) {
+			const auto array = new SectorsArray(chunkSize, flags & CHUNK_LOCAL);
+			array->fillSectorData<Types...>(reflectionHelper, capacity, flags & CACHE_LINE_STRIDE);
+
+			return array;
+		}
+
+		//container of types known only by ids at runtime, types should be already registered in reflectionHelper, members are placed in typeIds order
+		static SectorsArray* createSectorsArray(ReflectionHelper& reflectionHelper, const std::vector<ECSType>& typeIds, uint32_t capacity = 0, uint32_t chunkSize = 10240, uint8_t flags = DEFAULT) {
+			const auto array = new SectorsArray(chunkSize, flags & CHUNK_LOCAL);
+			array->fillSectorData(reflectionHelper, typeIds, capacity, flags & CACHE_LINE_STRIDE);
 
 			return array;
 		}
@@ -125,18 +162,96 @@ namespace ecss::Memory {
 
 		//clear will delete all sectors with members and destroy chunks
 		void clear();
+		/*drops all sectors - members are destroyed run by run (trivially destructible types are skipped), pending members are released
+		  with keepCapacity chunks and sectors map allocation are kept for reuse, otherwise it works like clear
+		*/
+		void reset(bool keepCapacity = true);
 
 		uint32_t capacity() const;
 		void reserve(uint32_t newCapacity);
 		void shrinkToFit();
+		//cuts sectors map to the biggest live sector id, so map size follows live sectors instead of the biggest id ever inserted
+		void shrinkSectorsMap();
 
 		size_t entitiesCapacity() const;
 
+		inline uint32_t getChunkSize() const { return mChunkSize; }
+		inline bool isChunkLocal() const { return mChunkLocal; }
+
+		//iteration through sector indices in sectors order, for default layout it is just [0, size())
+		inline size_t beginIdx() const {
+			if (!mChunkLocal) {
+				return 0;
+			}
+
+			return mChunkOrder.empty() ? endIdx() : static_cast<size_t>(mChunkOrder.front()) * mChunkSize;
+		}
+
+		inline size_t nextIdx(size_t idx) const {
+			if (!mChunkLocal) {
+				return idx + 1;
+			}
+
+			const auto chunk = idx / mChunkSize;
+			if (idx % mChunkSize + 1 < mChunkFill[chunk]) {
+				return idx + 1;
+			}
+
+			const auto pos = mChunkRank[chunk] + 1;
+			return pos < mChunkOrder.size() ? static_cast<size_t>(mChunkOrder[pos]) * mChunkSize : endIdx();
+		}
+
+		//every valid sector index is less than endIdx
+		inline size_t endIdx() const {
+			return mChunkLocal ? capacity() : size();
+		}
+
+		//count of chunks with sectors, and their sectors in sectors order
+		uint32_t chunksCount() const;
+		std::pair<Sector*, uint32_t> getChunkSpan(uint32_t pos) const;
+		//ids of sectors from getChunkSpan - every chunk keeps copy of its sector ids in separate column after sectors data, so seeks don't touch members memory
+		const SectorId* getChunkIds(uint32_t pos) const;
+
+		//index of the first sector with id not less than sectorId, endIdx if there is no such sector
+		size_t lowerBoundIdx(SectorId sectorId) const;
+
+		//changes every time sectors are moved in memory (emplace, erase, shift), sector indices and pointers taken with the same version are still valid
+		inline uint32_t getStructureVersion() const { return mStructureVersion; }
+
+		//all members can be copied with memcpy, so raw sectors data can be dumped as is
+		bool isTriviallyCopyable() const;
+
+		//memory taken by container, in bytes
+		struct MemoryUsage {
+			size_t chunksData = 0;//allocated chunks
+			size_t sectorsData = 0;//part of chunks data taken by sectors
+			size_t aliveHeaders = 0;//sector ids and alive flags of members, part of sectorsData
+			size_t sectorsMap = 0;
+			size_t chunksDirectory = 0;//chunk local layout bookkeeping
+			size_t idsColumns = 0;//sector ids columns of chunks
+
+			size_t total() const { return chunksData + sectorsMap + chunksDirectory + idsColumns; }
+		};
+
+		MemoryUsage getMemoryUsage() const;
+
+		//frozen container is immutable - it is read without locks, modifications are asserted in debug
+		inline bool isFrozen() const { return mFrozen.load(std::memory_order_relaxed); }
+		inline void setFrozen(bool frozen) { mFrozen.store(frozen, std::memory_order_relaxed); }
+
 		void* acquireSector(ECSType componentTypeId, SectorId sectorId);
 
+		//merges raw sectors data (same layout, sorted by id) into container with one pass, existing sectors with the same ids are overwritten
+		//works only for trivially copyable containers, sectors are moved with memcpy
+		void mergeSectors(const void* sectorsData, uint32_t count);
+
+		bool hasLayout(const std::vector<std::pair<ECSType, uint16_t>>& membersLayout, uint16_t sectorSize) const;
+
 		void destroyMember(ECSType componentTypeId, SectorId sectorId);
 		void destroyMembers(ECSType componentTypeId, std::vector<SectorId>& sectorIds, bool sort = true);
 		void destroySector(SectorId sectorId);
+		//destroys all sectors with ids in [first, last) and closes the gap with one shift
+		void destroySectorsRange(SectorId first, SectorId last);
 
 		inline Sector* tryGetSector(SectorId sectorId) const {
 			return sectorId >= mSectorsMap.size() || mSectorsMap[sectorId] == INVALID_ID ? nullptr : getSector(sectorId);
@@ -150,12 +265,18 @@ namespace ecss::Memory {
 			return idx / mChunkSize < mChunks.size() ? static_cast<Sector*>(static_cast<void*>(static_cast<char*>(mChunks.at(idx / mChunkSize)) + (idx % mChunkSize) * mSectorMeta.sectorSize)) : nullptr;
 		}
 
+		inline void prefetchSector(SectorId sectorId) const {
+			if (const auto sector = tryGetSector(sectorId)) {
+				ECSS_PREFETCH(sector);
+			}
+		}
+
 		inline SectorId getSectorIdx(SectorId sectorId) const {
 			return mSectorsMap[sectorId];
 		}
 
 		inline SectorId tryGetSectorIdx(SectorId sectorId) const {
-			return sectorId > mSectorsMap.size() ? INVALID_ID : mSectorsMap[sectorId];
+			return sectorId >= mSectorsMap.size() ? INVALID_ID : mSectorsMap[sectorId];
 		}
 
 		template<typename T>
@@ -209,6 +330,58 @@ namespace ecss::Memory {
 			new (sector) T(std::move(*data));
 		}
 
+		/*copies T members into dense columns - ids, values and validity bitmap (bit per row, set if member is alive), values of dead members are zeroed
+		  rows are sectors in sectors order, size() rows for the whole container, validity should be zeroed by caller
+		  chunks range [firstChunk, lastChunk) allows to export container from several threads, firstRow - row of the first sector of firstChunk
+		  validity bits are set with atomic or, because neighbour chunk ranges can share bitmap bytes
+		*/
+		template<typename T>
+		void exportColumn(ECSType typeId, SectorId* ids, T* values, uint8_t* validity, uint32_t firstChunk = 0, uint32_t lastChunk = INVALID_ID, size_t firstRow = 0) const {
+			static_assert(std::is_trivially_copyable_v<T>, "only trivially copyable types can be exported to columns");
+
+			const auto offset = getTypeOffset(typeId);
+			lastChunk = std::min(lastChunk, chunksCount());
+
+			auto row = firstRow;
+			for (auto pos = firstChunk; pos < lastChunk; pos++) {
+				const auto [sectors, count] = getChunkSpan(pos);
+				std::memcpy(ids + row, getChunkIds(pos), count * sizeof(SectorId));
+				for (auto i = 0u; i < count; i++, row++) {
+					const auto sector = static_cast<Sector*>(static_cast<void*>(static_cast<char*>(static_cast<void*>(sectors)) + static_cast<size_t>(i) * mSectorMeta.sectorSize));
+					if (const auto member = sector->getMember<T>(offset)) {
+						std::memcpy(values + row, member, sizeof(T));
+						std::atomic_ref(validity[row / 8]).fetch_or(static_cast<uint8_t>(1 << row % 8), std::memory_order_relaxed);
+					}
+					else {
+						std::memset(static_cast<void*>(values + row), 0, sizeof(T));
+					}
+				}
+			}
+		}
+
+		//lock free, can be called from any thread, member will be moved into the container with flushPending
+		template<typename T>
+		void enqueue(SectorId sectorId, T&& data, ECSType typeID) {
+			if (!hasType(typeID)) {
+				assert(false);
+				return;
+			}
+			assert(!isFrozen() && "frozen container can't be modified");
+
+			const auto member = new PendingMemberOf<std::decay_t<T>>(std::forward<T>(data));
+			member->sectorId = sectorId;
+			member->typeId = typeID;
+
+			member->next = mPendingHead.load(std::memory_order_relaxed);
+			while (!mPendingHead.compare_exchange_weak(member->next, member, std::memory_order_release, std::memory_order_relaxed)) {}
+		}
+
+		//moves all pending members into the container, sorted by sector id, new sectors are inserted with one merge pass
+		void flushPending();
+
+		//inserts empty sectors for sorted ids with one merge pass, already existing ids are skipped
+		void emplaceSectors(const std::vector<SectorId>& sortedIds);
+
 		inline bool hasType(ECSType typeId) const {
 			return mSectorMeta.membersLayout.contains(typeId);
 		}
@@ -217,12 +390,63 @@ namespace ecss::Memory {
 			return mSectorMeta.membersLayout.at(typeId);
 		}
 
+		//bit of member in Sector::aliveMask
+		inline uint32_t getTypeBit(ECSType typeId) const {
+			return mSectorMeta.membersBits.at(typeId);
+		}
+
 		inline const SectorMetadata& getSectorData() { return mSectorMeta; }
 
 		void removeEmptySectors();
 
+		//index of previous (published) buffer for DoubleBuffered members
+		inline uint8_t getFrontBuffer() const { return mFrontBuffer.load(std::memory_order_acquire); }
+		//publishes next values of all DoubleBuffered members of the container
+		inline void swapBuffers() { mFrontBuffer.fetch_xor(1, std::memory_order_acq_rel); }
+
 	private:
+		//chunk local layout
+		Sector* emplaceChunkLocalSector(SectorId sectorId);
+		void eraseChunkLocal(size_t idx);
+		void eraseChunkLocal(uint32_t chunk, uint32_t begin, uint32_t count, bool merge = true);
+		void tryMergeChunks(uint32_t pos);
+		void clearChunkLocal();
+		void removeEmptyChunkLocalSectors();
+		void destroyChunkLocalRange(SectorId first, SectorId last);
+		void copyChunkLocal(const SectorsArray& other, bool move);
+
+		uint32_t takeFreeChunk();
+		void insertChunkToOrder(uint32_t pos, uint32_t chunk);
+		void removeChunkFromOrder(uint32_t pos);
+		uint32_t findChunkPos(SectorId sectorId) const;
+		uint32_t lowerBoundInChunk(uint32_t chunk, SectorId sectorId) const;
+
+		//moves sector members and header to the place, updates sectors map
+		void relocateSector(Sector* from, size_t toIdx);
+
+		//moves run of sectors with bulk function table calls (like memmove), both runs should be inside of chunks, updates sectors map
+		void moveSectors(size_t toIdx, size_t fromIdx, size_t count);
+		//moves or copies all sectors of other array to the same indices run by run, chunk sizes of arrays can differ
+		void transferSectors(const SectorsArray& other, bool move);
+
 		void* initSectorMember(Sector* sector, ECSType componentTypeId) const;
+		//alive mask of raw copied sector is built from alive flags, members bits of the source can differ
+		void restoreAliveMask(Sector* sector) const;
+
+		//ids column is placed after sectors data of the chunk, so it is allocated, released and reordered together with the chunk
+		inline size_t idsColumnOffset() const {
+			return (static_cast<size_t>(mChunkSize) * mSectorMeta.sectorSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+		}
+
+		inline SectorId* chunkIds(size_t chunk) const {
+			return static_cast<SectorId*>(static_cast<void*>(static_cast<char*>(mChunks[chunk]) + idsColumnOffset()));
+		}
+
+		//every sector placement goes through it - sectors map and ids column are updated together
+		inline void setSectorIdx(SectorId sectorId, size_t idx) {
+			mSectorsMap[sectorId] = static_cast<SectorId>(idx);
+			chunkIds(idx / mChunkSize)[idx % mChunkSize] = sectorId;
+		}
 
 		void incrementCapacity();
 
@@ -230,6 +454,9 @@ namespace ecss::Memory {
 		void destroyMember(Sector* sector, ECSType typeId) const;
 		void destroySector(Sector* sector);
 		void destroySectors(size_t begin, size_t count = 1);
+		//destroys alive members of sectors run without erasing sectors
+		void destroySectorsMembers(size_t begin, size_t count);
+		void releasePending();
 
 		void erase(size_t begin, size_t count = 1);
 
@@ -242,21 +469,50 @@ namespace ecss::Memory {
 		//caution - shifting on alive data will produce memory leak
 		void shiftDataLeft(size_t from, size_t count = 1);
 
+		void addSectorMember(ReflectionHelper& reflectionHelper, ECSType typeId) {
+			const auto functions = reflectionHelper.getFunctionTable(typeId);
+			assert(functions.size && "type should be registered in reflection helper");
+
+			//member data placed right after 8 bytes of is alive bool, and should be aligned relative to sector begin (sectors and chunks are aligned by the biggest member alignment)
+			const auto dataOffset = (mSectorMeta.sectorSize + 8 + functions.alignment - 1) / functions.alignment * functions.alignment;
+			mSectorMeta.membersLayout[typeId] = static_cast<uint16_t>(dataOffset - 8);
+			mSectorMeta.sectorSize = static_cast<uint16_t>(dataOffset + functions.size);
+			mSectorMeta.alignment = std::max(mSectorMeta.alignment, functions.alignment);
+			mSectorMeta.typeFunctionsTable[typeId] = functions;
+		}
+
 		template <typename... Types>
-		void fillSectorData(ReflectionHelper& reflectionHelper, uint32_t capacity) {
+		void fillSectorData(ReflectionHelper& reflectionHelper, uint32_t capacity, bool cacheLineStride) {
 			static_assert(types::areUnique<Types...>(), "Duplicates detected in types");
+			static_assert(sizeof...(Types) <= MAX_SECTOR_MEMBERS, "sector alive mask has bits only for 32 members");
+
+			fillSectorData(reflectionHelper, { reflectionHelper.getTypeId<Types>()... }, capacity, cacheLineStride);
+		}
+
+		void fillSectorData(ReflectionHelper& reflectionHelper, const std::vector<ECSType>& typeIds, uint32_t capacity, bool cacheLineStride) {
+			if (typeIds.size() > MAX_SECTOR_MEMBERS) {//members without alive bit would silently corrupt liveness, so release builds stop too
+				assert(false && "sector alive mask has bits only for 32 members");
+				std::abort();
+			}
 
 			mSectorMeta.sectorSize = static_cast<uint16_t>((sizeof(Sector) + 8 - 1) / 8 * 8);
-			((
-				mSectorMeta.membersLayout[reflectionHelper.getTypeId<Types>()] = mSectorMeta.sectorSize,
-				mSectorMeta.sectorSize += static_cast<uint16_t>(8 + (sizeof(Types) + alignof(Types) - 1) / alignof(Types) * alignof(Types)), //+8 for is alive bool
-				mSectorMeta.typeFunctionsTable[reflectionHelper.getTypeId<Types>()] = reflectionHelper.functionsTable.at(reflectionHelper.getTypeId<Types>())
-			)
-			, ...);
-
-			mSectorMeta.sectorSize = (mSectorMeta.sectorSize + alignof(Sector) - 1) / alignof(Sector) * alignof(Sector);
+			mSectorMeta.alignment = static_cast<uint16_t>(alignof(Sector));
+			for (const auto typeId : typeIds) {
+				addSectorMember(reflectionHelper, typeId);
+			}
+
+			const uint16_t stride = cacheLineStride ? std::max(CACHE_LINE_SIZE, mSectorMeta.alignment) : mSectorMeta.alignment;
+			mSectorMeta.sectorSize = (mSectorMeta.sectorSize + stride - 1) / stride * stride;
+			mSectorMeta.alignment = std::max(CACHE_LINE_SIZE, mSectorMeta.alignment);
 			mSectorMeta.membersLayout.shrinkToFit();
 
+			uint32_t bit = 1;
+			for (auto& [typeId, offset] : mSectorMeta.membersLayout) {
+				mSectorMeta.membersBits[typeId] = bit;
+				bit <<= 1;
+			}
+			mSectorMeta.membersBits.shrinkToFit();
+
 			reserve(capacity);
 		}
 
@@ -266,7 +522,19 @@ namespace ecss::Memory {
 
 		SectorMetadata mSectorMeta;
 		uint32_t mSize = 0;
+		uint32_t mStructureVersion = 0;
+		std::atomic<uint8_t> mFrontBuffer = 0;
+		std::atomic<PendingMember*> mPendingHead = nullptr;
+		std::atomic<bool> mFrozen = false;
 		
 		const uint32_t mChunkSize;
+		const bool mChunkLocal;
+
+		//chunk local layout only
+		std::vector<uint32_t> mChunkFill;//sectors count in chunk
+		std::vector<uint32_t> mChunkRank;//position of chunk in mChunkOrder, INVALID_ID for free chunks
+		std::vector<uint32_t> mChunkOrder;//chunks with sectors sorted by sector ids
+		std::vector<SectorId> mChunkFirstIds;//chunks directory - first sector id of every chunk from mChunkOrder
+		std::vector<uint32_t> mFreeChunks;
 	};
 }